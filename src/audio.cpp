@@ -0,0 +1,50 @@
+#include "audio.hpp"
+#include "timeline.hpp"
+#include <iostream>
+#include <SDL2/SDL.h>
+
+Audio::Audio(BeeperMailbox const& mailbox, unsigned int bufferSamples)
+	: mailbox(mailbox), beeper(AUDIO_SAMPLE_RATE, BEEP_FREQUENCY)
+{
+	SDL_InitSubSystem(SDL_INIT_AUDIO);
+
+	SDL_AudioSpec desired{};
+	desired.freq = AUDIO_SAMPLE_RATE;
+	desired.format = AUDIO_S16SYS;
+	desired.channels = 1;
+	desired.samples = static_cast<Uint16>(bufferSamples);
+	desired.callback = Callback;
+	desired.userdata = this;
+
+	SDL_AudioSpec obtained{};
+	device = SDL_OpenAudioDevice(nullptr, 0, &desired, &obtained, 0);
+	if (device == 0)
+	{
+		std::cerr << "Audio disabled: " << SDL_GetError() << "\n";
+		return;
+	}
+
+	SDL_PauseAudioDevice(device, 0);
+}
+
+Audio::~Audio()
+{
+	if (device != 0)
+	{
+		SDL_CloseAudioDevice(device);
+	}
+	SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+
+void Audio::Callback(void* userdata, uint8_t* stream, int len)
+{
+	Audio* audio = static_cast<Audio*>(userdata);
+	if (TimelineActive())
+	{
+		SetTimelineThreadName("audio");
+	}
+	TIMELINE_SCOPE("audio callback");
+
+	audio->beeper.Poll(audio->mailbox);
+	audio->beeper.Generate(reinterpret_cast<int16_t*>(stream), len / sizeof(int16_t));
+}
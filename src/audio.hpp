@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include "beeper.hpp"
+
+// SDL audio output for the beeper. The callback runs on SDL's audio
+// thread and only reads the mailbox, so a small buffer keeps latency low.
+class Audio
+{
+public:
+	Audio(BeeperMailbox const& mailbox, unsigned int bufferSamples);
+	~Audio();
+
+private:
+	static void Callback(void* userdata, uint8_t* stream, int len);
+
+	BeeperMailbox const& mailbox;
+	Beeper beeper;
+	uint32_t device{};
+};
@@ -0,0 +1,104 @@
+#include "beeper.hpp"
+
+void BeeperMailbox::Publish(uint8_t soundTimer)
+{
+	// Only the emulation thread writes, so the sequence needs no atomics
+	++sequence;
+	state.store((sequence << 8) | soundTimer, std::memory_order_release);
+}
+
+Beeper::Beeper(unsigned int sampleRate, unsigned int frequency)
+	: sampleRate(sampleRate), halfPeriod(sampleRate / (2 * frequency))
+{
+}
+
+void Beeper::Trigger(uint8_t soundTimer)
+{
+	remaining = soundTimer * sampleRate / 60;
+}
+
+void Beeper::Poll(BeeperMailbox const& mailbox)
+{
+	uint32_t state = mailbox.Read();
+	if (state != lastState)
+	{
+		lastState = state;
+		Trigger(state & 0xFFu);
+	}
+}
+
+void Beeper::Generate(int16_t* samples, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		if (remaining > 0)
+		{
+			samples[i] = phase < halfPeriod ? BEEP_AMPLITUDE : -BEEP_AMPLITUDE;
+			--remaining;
+		}
+		else
+		{
+			samples[i] = 0;
+		}
+
+		if (++phase == 2 * halfPeriod)
+		{
+			phase = 0;
+		}
+	}
+}
+
+WavWriter::WavWriter(char const* filename, unsigned int sampleRate)
+	: file(filename, std::ios::binary), sampleRate(sampleRate)
+{
+	if (file.is_open())
+	{
+		WriteHeader();
+	}
+}
+
+WavWriter::~WavWriter()
+{
+	if (file.is_open())
+	{
+		// Patch the chunk sizes now that the sample count is known
+		file.seekp(0, std::ios::beg);
+		WriteHeader();
+	}
+}
+
+static void WriteLE(std::ofstream& file, uint32_t value, int bytes)
+{
+	for (int i = 0; i < bytes; ++i)
+	{
+		file.put(static_cast<char>((value >> (8 * i)) & 0xFFu));
+	}
+}
+
+void WavWriter::WriteHeader()
+{
+	uint32_t dataSize = sampleCount * 2;
+
+	file.write("RIFF", 4);
+	WriteLE(file, 36 + dataSize, 4);
+	file.write("WAVE", 4);
+	file.write("fmt ", 4);
+	WriteLE(file, 16, 4);             // fmt chunk size
+	WriteLE(file, 1, 2);              // PCM
+	WriteLE(file, 1, 2);              // mono
+	WriteLE(file, sampleRate, 4);
+	WriteLE(file, sampleRate * 2, 4); // byte rate
+	WriteLE(file, 2, 2);              // block align
+	WriteLE(file, 16, 2);             // bits per sample
+	file.write("data", 4);
+	WriteLE(file, dataSize, 4);
+}
+
+void WavWriter::Write(int16_t const* samples, unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		WriteLE(file, static_cast<uint16_t>(samples[i]), 2);
+	}
+	sampleCount += count;
+}
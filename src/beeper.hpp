@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+
+const unsigned int AUDIO_SAMPLE_RATE = 44100;
+const unsigned int DEFAULT_AUDIO_BUFFER = 512;
+const unsigned int BEEP_FREQUENCY = 440;
+const int16_t BEEP_AMPLITUDE = 3000;
+
+// Sound timer state handed from the emulation thread to the audio
+// callback. Sequence and timer value are packed in a single word so
+// neither side ever takes a lock.
+class BeeperMailbox
+{
+public:
+	void Publish(uint8_t soundTimer);
+	uint32_t Read() const { return state.load(std::memory_order_acquire); }
+
+private:
+	std::atomic<uint32_t> state{0};
+	uint32_t sequence{};
+};
+
+// Square wave generator driven by the sound timer
+class Beeper
+{
+public:
+	Beeper(unsigned int sampleRate, unsigned int frequency);
+	// Play the tone for as long as the timer value lasts
+	void Trigger(uint8_t soundTimer);
+	// Pick up the latest state published to the mailbox, if it changed
+	void Poll(BeeperMailbox const& mailbox);
+	void Generate(int16_t* samples, unsigned int count);
+
+private:
+	unsigned int sampleRate;
+	unsigned int halfPeriod;
+	unsigned int phase{};
+	unsigned int remaining{};
+	uint32_t lastState{};
+};
+
+// 16-bit mono PCM WAV file, for checking audio output without a device
+class WavWriter
+{
+public:
+	WavWriter(char const* filename, unsigned int sampleRate);
+	~WavWriter();
+	bool IsOpen() const { return file.is_open(); }
+	void Write(int16_t const* samples, unsigned int count);
+
+private:
+	void WriteHeader();
+
+	std::ofstream file;
+	unsigned int sampleRate;
+	uint32_t sampleCount{};
+};
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#include <malloc.h>
+#include <unistd.h>
+#include "chip8.hpp"
+#include "env.hpp"
+#include "pool.hpp"
+#include "workload.hpp"
+
+struct BenchResult
+{
+	double seconds;
+	uint64_t hash;
+};
+
+// Run from a copy of the freshly loaded machine, with no keys pressed
+static BenchResult Run(Chip8 const& loaded, bool fusion, unsigned long frames, unsigned int cyclesPerFrame)
+{
+	Chip8 chip8 = loaded;
+	chip8.SetFusion(fusion);
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned long frame = 0; frame < frames; ++frame)
+	{
+		chip8.RunFrame(cyclesPerFrame);
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	return BenchResult{ std::chrono::duration<double>(end - start).count(), chip8.Hash() };
+}
+
+// Step a batch of environments one frame at a time with no keys pressed,
+// observations included, for as many machine frames as a single run
+static double RunEnv(Env& env, unsigned long frames)
+{
+	std::vector<uint16_t> actions(env.Count());
+	unsigned long steps = frames / env.Count();
+	env.Reset(1);
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned long step = 0; step < steps; ++step)
+	{
+		env.Step(actions.data(), 1);
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end - start).count();
+}
+
+// Resident set size of the process, or 0 where /proc is missing
+static size_t ResidentBytes()
+{
+	std::ifstream statm("/proc/self/statm");
+	size_t size = 0;
+	size_t resident = 0;
+	statm >> size >> resident;
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+struct PoolResult
+{
+	double bytesPerMachine;
+	uint64_t hash;
+};
+
+// Acquire a whole pool of machines running one ROM and run each for the
+// given frames, with no keys pressed. The resident set growth over the
+// pool's lifetime is its footprint, as long as nothing before it freed
+// memory the pool could reuse.
+static PoolResult RunPool(PoolMemory memory, unsigned int count, uint8_t const* data, size_t size,
+	QuirkProfile profile, unsigned long frames, unsigned int cyclesPerFrame)
+{
+	size_t before = ResidentBytes();
+	Chip8Pool pool(count, memory);
+	int rom = pool.AddROM(data, size, profile);
+	if (rom < 0)
+	{
+		std::cerr << "Cannot load ROM into a pool\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	uint64_t hash = 0;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		Chip8* chip8 = pool.Acquire(rom);
+		for (unsigned long frame = 0; frame < frames; ++frame)
+		{
+			chip8->RunFrame(cyclesPerFrame);
+		}
+		hash = hash * 31 + chip8->Hash();
+	}
+
+	double bytes = double(ResidentBytes() - before);
+	return PoolResult{ bytes / count, hash };
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<char const*> romFilenames;
+	std::vector<Workload> workloads;
+	unsigned long frames = 100000;
+	unsigned int cyclesPerFrame = 1000;
+	QuirkProfile profile = DEFAULT_QUIRK_PROFILE;
+	unsigned int envCount = 0;
+	unsigned int poolCount = 0;
+	unsigned int repeats = 3;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			frames = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--cycles-per-frame") == 0 && i + 1 < argc)
+		{
+			cyclesPerFrame = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+		{
+			if (!ParseQuirkProfile(argv[++i], profile))
+			{
+				std::cerr << "Unknown profile " << argv[i] << ", expected vip, chip48, schip or modern\n";
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+		{
+			repeats = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--env") == 0 && i + 1 < argc)
+		{
+			envCount = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--pool") == 0 && i + 1 < argc)
+		{
+			poolCount = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--workload") == 0 && i + 1 < argc)
+		{
+			Workload workload;
+			if (std::strcmp(argv[++i], "all") == 0)
+			{
+				for (unsigned int w = 0; w < static_cast<unsigned int>(Workload::Count); ++w)
+				{
+					workloads.push_back(static_cast<Workload>(w));
+				}
+			}
+			else if (ParseWorkload(argv[i], workload))
+			{
+				workloads.push_back(workload);
+			}
+			else
+			{
+				std::cerr << "Unknown workload " << argv[i] << ", expected all, sprites, calls, blockmove, selfmodify or skips\n";
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		else if (argv[i][0] != '-')
+		{
+			romFilenames.push_back(argv[i]);
+		}
+		else
+		{
+			romFilenames.clear();
+			workloads.clear();
+			break;
+		}
+	}
+
+	if ((romFilenames.empty() && workloads.empty()) || envCount > frames || poolCount > frames
+		|| (envCount != 0 && poolCount != 0))
+	{
+		std::cerr << "Usage: " << argv[0] << " [--frames <n>] [--cycles-per-frame <n>] [--profile <name>]"
+			<< " [--repeat <n>] [--env <count> | --pool <count>] [--workload <name>]... [<ROM>...]\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	// Both runs must end in the same state, or the comparison is void
+	int exitCode = 0;
+	double instructions = double(frames) * cyclesPerFrame;
+	if (envCount != 0)
+	{
+		std::printf("%-24s %14s %14s\n", "ROM", "env frames/s", "ns/inst");
+	}
+	else if (poolCount != 0)
+	{
+		std::printf("%-24s %14s %14s %8s\n", "ROM", "private KB", "shared KB", "saving");
+		// Fixed malloc thresholds hand every freed pool back to the
+		// system, so each pool starts from nothing
+		mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+		mallopt(M_TRIM_THRESHOLD, 128 * 1024);
+	}
+	else
+	{
+		std::printf("%-24s %14s %14s %8s\n", "ROM", "plain ns/inst", "fused ns/inst", "speedup");
+	}
+
+	// Generated workloads loop, so they keep running for any frame count
+	std::vector<WorkloadRom> workloadRoms(workloads.size());
+	std::vector<char const*> names;
+	for (size_t i = 0; i < workloads.size(); ++i)
+	{
+		WorkloadOptions options;
+		options.loop = true;
+		GenerateWorkload(workloads[i], options, workloadRoms[i]);
+		names.push_back(WorkloadName(workloads[i]));
+	}
+	names.insert(names.end(), romFilenames.begin(), romFilenames.end());
+
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		// Throughput of the batched training interface instead
+		if (envCount != 0)
+		{
+			Env env(envCount, ObservationFormat::Pixels, cyclesPerFrame, profile);
+			bool romLoaded = i < workloadRoms.size()
+				? env.LoadROM(workloadRoms[i].data.data(), workloadRoms[i].data.size())
+				: env.LoadROM(names[i]);
+			if (!romLoaded)
+			{
+				std::cerr << "Cannot load " << names[i] << "\n";
+				std::exit(EXIT_FAILURE);
+			}
+
+			double seconds = RunEnv(env, frames);
+			double envFrames = double(frames / envCount * envCount);
+			std::printf("%-24s %14.0f %14.2f\n", names[i], envFrames / seconds,
+				seconds * 1e9 / (envFrames * cyclesPerFrame));
+			continue;
+		}
+
+		// Resident memory per machine of a private and a shared pool
+		if (poolCount != 0)
+		{
+			std::vector<uint8_t> data;
+			if (i < workloadRoms.size())
+			{
+				data = workloadRoms[i].data;
+			}
+			else
+			{
+				std::ifstream file(names[i], std::ios::binary);
+				data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			}
+			// Shared first, in case the private pool leaves memory behind
+			unsigned long poolFrames = frames / poolCount;
+			PoolResult shared = RunPool(PoolMemory::Shared, poolCount, data.data(), data.size(), profile, poolFrames, cyclesPerFrame);
+			PoolResult separate = RunPool(PoolMemory::Private, poolCount, data.data(), data.size(), profile, poolFrames, cyclesPerFrame);
+			std::printf("%-24s %14.2f %14.2f %7.0f%%%s\n", names[i], separate.bytesPerMachine / 1024, shared.bytesPerMachine / 1024,
+				100 * (1 - shared.bytesPerMachine / separate.bytesPerMachine),
+				separate.hash == shared.hash ? "" : "  STATE MISMATCH");
+			if (separate.hash != shared.hash)
+			{
+				exitCode = 1;
+			}
+			continue;
+		}
+
+		Chip8 loaded;
+		loaded.SetQuirkProfile(profile);
+		loaded.Seed(1);
+		bool romLoaded = i < workloadRoms.size()
+			? loaded.LoadROM(workloadRoms[i].data.data(), workloadRoms[i].data.size())
+			: loaded.LoadROM(names[i]);
+		if (!romLoaded)
+		{
+			std::cerr << "Cannot load " << names[i] << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+
+		// Alternate the modes and keep the fastest run of each, so that
+		// noise from the rest of the system hits both alike
+		BenchResult plain = Run(loaded, false, frames, cyclesPerFrame);
+		BenchResult fused = Run(loaded, true, frames, cyclesPerFrame);
+		for (unsigned int repeat = 1; repeat < repeats; ++repeat)
+		{
+			plain.seconds = std::min(plain.seconds, Run(loaded, false, frames, cyclesPerFrame).seconds);
+			fused.seconds = std::min(fused.seconds, Run(loaded, true, frames, cyclesPerFrame).seconds);
+		}
+
+		std::printf("%-24s %14.2f %14.2f %7.2fx%s\n", names[i],
+			plain.seconds * 1e9 / instructions, fused.seconds * 1e9 / instructions,
+			plain.seconds / fused.seconds, plain.hash == fused.hash ? "" : "  STATE MISMATCH");
+
+		if (plain.hash != fused.hash)
+		{
+			exitCode = 1;
+		}
+	}
+
+	return exitCode;
+}
@@ -1,8 +1,12 @@
 #include <fstream>
 #include <random>
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <ctime>
 #include "chip8.hpp"
+#include "rompack.hpp"
+#include "trace.hpp"
 
 const unsigned int START_ADDRESS = 0x200;
 const unsigned int FONTSET_SIZE = 80;
@@ -28,69 +32,727 @@ uint8_t fontset[FONTSET_SIZE] =
 	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+// A profile's quirks on a machine with shared memory. Which memory a
+// machine reads is then fixed at compile time like the quirks, so private
+// machines never test for shared pages.
+template<typename Quirks>
+struct SharedMemory : Quirks
+{
+};
+
+template<typename Quirks>
+struct UsesSharedMemory
+{
+    static const bool value = false;
+};
+
+template<typename Quirks>
+struct UsesSharedMemory<SharedMemory<Quirks>>
+{
+    static const bool value = true;
+};
+
 Chip8::Chip8() {
+    SetQuirkProfile(DEFAULT_QUIRK_PROFILE);
     init();
 }
 
-// Initialise
-void Chip8::init() {
-    programCounter=START_ADDRESS;
-    opcode = 0; // Reset op code
-    index = 0; // Reset index
-    stackPointer = 0; // Reset stack pointer
+Chip8::Chip8(Chip8State const& shared)
+    : quirkProfile(DEFAULT_QUIRK_PROFILE)
+{
+    LoadShared(shared);
+}
+
+void Chip8::SetQuirkProfile(QuirkProfile profile) {
+    quirkProfile = profile;
+    SelectHandlers();
+}
 
-    // Reset timers
-    delayTimer = 0;
-    soundTimer = 0;
+void Chip8::SelectHandlers() {
+    switch (quirkProfile)
+    {
+        case QuirkProfile::CosmacVip:
+            SelectHandlers<CosmacVipQuirks>();
+            break;
+        case QuirkProfile::Chip48:
+            SelectHandlers<Chip48Quirks>();
+            break;
+        case QuirkProfile::SuperChip:
+            SelectHandlers<SuperChipQuirks>();
+            break;
+        case QuirkProfile::Modern:
+            SelectHandlers<ModernQuirks>();
+            break;
+    }
+}
 
-    // Clear the display
-    for (int i = 0; i < 2048; ++i) {
-        display[i] = 0;
+template<typename Quirks>
+void Chip8::SelectHandlers() {
+    if (memory.Shared())
+    {
+        step = &Chip8::Step<SharedMemory<Quirks>>;
+        runFused = &Chip8::RunFused<SharedMemory<Quirks>>;
+    }
+    else
+    {
+        step = &Chip8::Step<Quirks>;
+        runFused = &Chip8::RunFused<Quirks>;
     }
+}
 
-    // Clear the stack, keypad, and registers
-    for (int i = 0; i < 16; ++i) {
-        stack[i] = 0;
-        keyPad[i] = 0;
-        registers[i] = 0;
+bool ParseQuirkProfile(char const* name, QuirkProfile& profile) {
+    static struct { char const* name; QuirkProfile profile; } const names[] =
+    {
+        { "vip", QuirkProfile::CosmacVip },
+        { "chip48", QuirkProfile::Chip48 },
+        { "schip", QuirkProfile::SuperChip },
+        { "modern", QuirkProfile::Modern },
+    };
+
+    for (auto const& entry : names)
+    {
+        if (strcmp(name, entry.name) == 0)
+        {
+            profile = entry.profile;
+            return true;
+        }
     }
+    return false;
+}
 
-    // Clear memory
-    for (int i = 0; i < 4096; ++i) {
-        memory[i] = 0;
+char const* QuirkProfileName(QuirkProfile profile) {
+    switch (profile)
+    {
+        case QuirkProfile::CosmacVip:
+            return "vip";
+        case QuirkProfile::Chip48:
+            return "chip48";
+        case QuirkProfile::SuperChip:
+            return "schip";
+        case QuirkProfile::Modern:
+            return "modern";
     }
+    return "unknown";
+}
+
+// Initialise
+void Chip8::init() {
+    // Clear the whole machine state in one go
+    static_cast<Chip8Core&>(*this) = Chip8Core();
+    dirtyRows = ALL_DISPLAY_ROWS;
+    fusion.Forget(ALL_MEMORY_PAGES);
+    uint8_t* block = memory.MakePrivate(false);
+    memset(block, 0, MEMORY_SIZE);
+    SelectHandlers();
+    programCounter=START_ADDRESS;
 
     // Load font set into memory
+    memcpy(block + FONTSET_START_ADDRESS, fontset, FONTSET_SIZE);
     for (unsigned int i = 0; i < FONTSET_SIZE; ++i)
     {
-        memory[FONTSET_START_ADDRESS+i] = fontset[i];
+        memoryHash ^= MemoryKey(FONTSET_START_ADDRESS + i, fontset[i]);
     }
 
     //random seed for RNG's process
-    srand(time(NULL));
+    Seed(time(NULL));
 }
 
-void Chip8::LoadROM(char const* filename)
+bool Chip8::LoadROM(char const* filename)
 {
     std::ifstream file(filename, std::ios::binary | std::ios::ate );
-    if(file.is_open()) 
-    {
-        std::streampos size = file.tellg();
-        file.seekg(0, std::ios::beg);
-        char* buffer = new char[size];
-        file.read (buffer,size);
-        file.close();
-        for (long i =0; i<size; ++i) {
-            memory[START_ADDRESS+i] = buffer[i];
+    if(!file.is_open()) 
+    {
+        return false;
+    }
+
+    std::streampos size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    char* buffer = new char[size];
+    file.read (buffer,size);
+    file.close();
+    bool loaded = LoadROM(reinterpret_cast<uint8_t const*>(buffer), size);
+    delete[] buffer;
+    return loaded;
+}
+
+bool Chip8::LoadROM(uint8_t const* data, size_t size)
+{
+    // Anything past the end of memory is dropped
+    if (size > MEMORY_SIZE - START_ADDRESS)
+    {
+        size = MEMORY_SIZE - START_ADDRESS;
+    }
+    uint8_t* block = memory.MakePrivate(true);
+    SelectHandlers();
+    for (size_t i = 0; i < size; ++i)
+    {
+        memoryHash ^= MemoryKey(START_ADDRESS + i, block[START_ADDRESS + i]) ^ MemoryKey(START_ADDRESS + i, data[i]);
+    }
+    memcpy(block + START_ADDRESS, data, size);
+    fusion.Forget(ALL_MEMORY_PAGES);
+    for (unsigned int page = START_ADDRESS / PAGE_SIZE; page * PAGE_SIZE < START_ADDRESS + size; ++page)
+    {
+        dirtyPages |= 1u << page;
+    }
+    return size > 0;
+}
+
+bool Chip8::LoadROM(RomPack const& pack, RomPackEntry const& entry)
+{
+    return LoadROM(pack.Data(entry), entry.dataSize);
+}
+
+void Chip8::CopyCore(Chip8State const& state)
+{
+    static_cast<Chip8Core&>(*this) = state;
+    dirtyRows = ALL_DISPLAY_ROWS;
+}
+
+void Chip8::LoadState(Chip8State const& state)
+{
+    CopyCore(state);
+    fusion.Forget(ALL_MEMORY_PAGES);
+    memcpy(memory.MakePrivate(false), state.memory, MEMORY_SIZE);
+    SelectHandlers();
+}
+
+void Chip8::RestoreDirty(Chip8State const& state)
+{
+    // Shared memory is not in the block, so it is all restored
+    uint16_t dirty = memory.Shared() ? ALL_MEMORY_PAGES : dirtyPages;
+    // Sequences in the page before can run into a restored one
+    fusion.Forget(dirty | dirty >> 1 | dirty << (PAGE_COUNT - 1));
+    CopyCore(state);
+    uint8_t* block = memory.MakePrivate(false);
+    SelectHandlers();
+
+    for (unsigned int page = 0; dirty != 0; ++page, dirty >>= 1)
+    {
+        if (dirty & 1u)
+        {
+            memcpy(block + page * PAGE_SIZE, state.memory + page * PAGE_SIZE, PAGE_SIZE);
+        }
+    }
+}
+
+void Chip8::LoadShared(Chip8State const& state)
+{
+    CopyCore(state);
+    memory.Share(state.memory);
+    fusion.Forget(ALL_MEMORY_PAGES);
+    SelectHandlers();
+}
+
+void Chip8::SaveState(Chip8State& state) const
+{
+    static_cast<Chip8Core&>(state) = *this;
+    for (unsigned int page = 0; page < PAGE_COUNT; ++page)
+    {
+        memcpy(state.memory + page * PAGE_SIZE, memory.Page(page), PAGE_SIZE);
+    }
+}
+
+Chip8::PagedMemory& Chip8::PagedMemory::operator=(PagedMemory const& other)
+{
+    if (other.Shared())
+    {
+        Share(other.snapshot);
+        for (unsigned int page = 0; page < PAGE_COUNT; ++page)
+        {
+            if (!(other.sharedPages & (1u << page)))
+            {
+                memcpy(WritablePage(page), other.copies[page].get(), PAGE_SIZE);
+            }
         }
-        delete[] buffer;
     }
+    else if (other.block)
+    {
+        memcpy(MakePrivate(false), other.block.get(), MEMORY_SIZE);
+    }
+    return *this;
+}
+
+uint8_t* Chip8::PagedMemory::MakePrivate(bool keepContents)
+{
+    if (!block)
+    {
+        block.reset(new uint8_t[MEMORY_SIZE]);
+    }
+    for (unsigned int page = 0; page < PAGE_COUNT; ++page)
+    {
+        if (keepContents && pages[page] != nullptr)
+        {
+            memmove(block.get() + page * PAGE_SIZE, pages[page], PAGE_SIZE);
+        }
+        pages[page] = block.get() + page * PAGE_SIZE;
+    }
+    snapshot = nullptr;
+    sharedPages = 0;
+    return block.get();
+}
+
+void Chip8::PagedMemory::Share(uint8_t const* shared)
+{
+    snapshot = shared;
+    sharedPages = ALL_MEMORY_PAGES;
+    for (unsigned int page = 0; page < PAGE_COUNT; ++page)
+    {
+        pages[page] = snapshot + page * PAGE_SIZE;
+    }
+}
+
+void Chip8::PagedMemory::Unshare(unsigned int page)
+{
+    if (!copies[page])
+    {
+        copies[page].reset(new uint8_t[PAGE_SIZE]);
+    }
+    memcpy(copies[page].get(), snapshot + page * PAGE_SIZE, PAGE_SIZE);
+    pages[page] = copies[page].get();
+    sharedPages &= ~(1u << page);
+}
+
+template<typename Quirks>
+uint8_t Chip8::Read(unsigned int address) const
+{
+    address &= ADDRESS_MASK;
+    if (UsesSharedMemory<Quirks>::value)
+    {
+        return memory.Page(address / PAGE_SIZE)[address % PAGE_SIZE];
+    }
+    return memory.Block()[address];
+}
+
+template<typename Quirks>
+void Chip8::Write(unsigned int address, uint8_t value)
+{
+    address &= ADDRESS_MASK;
+    // Copy on write: only the first write to a shared page pays for it
+    uint8_t& byte = UsesSharedMemory<Quirks>::value
+        ? memory.WritablePage(address / PAGE_SIZE)[address % PAGE_SIZE]
+        : memory.Block()[address];
+    memoryHash ^= MemoryKey(address, byte) ^ MemoryKey(address, value);
+    byte = value;
+    dirtyPages |= 1u << (address / PAGE_SIZE);
+    fusion.Invalidate(address);
+}
+
+// splitmix64 finalizer
+static uint64_t Mix(uint64_t value)
+{
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+}
+
+// Keys for lit pixels. A clear display hashes to zero.
+static uint64_t const* PixelKeys()
+{
+    static struct Table
+    {
+        uint64_t keys[DISPLAY_WIDTH * DISPLAY_HEIGHT];
+        Table()
+        {
+            for (unsigned int i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; ++i)
+            {
+                keys[i] = Mix(0x100000u + i); // Above any memory key input
+            }
+        }
+    } const table;
+    return table.keys;
+}
+
+// Zero bytes contribute nothing, so cleared memory hashes to zero
+uint64_t Chip8::MemoryKey(unsigned int address, uint8_t value)
+{
+    return value != 0 ? Mix(address << 8 | value) : 0;
+}
+
+uint64_t Chip8::HashRegisters() const
+{
+    uint64_t hash = Mix(index | uint64_t(programCounter) << 16 | uint64_t(stackPointer) << 32
+        | uint64_t(delayTimer) << 40 | uint64_t(soundTimer) << 48 | uint64_t(trap) << 56);
+    hash = Mix(hash ^ randomState);
+
+    uint64_t words[(REGISTER_COUNT + sizeof(stack) + KEY_COUNT) / 8];
+    memcpy(words, registers, REGISTER_COUNT);
+    memcpy(reinterpret_cast<char*>(words) + REGISTER_COUNT, stack, sizeof(stack));
+    memcpy(reinterpret_cast<char*>(words) + REGISTER_COUNT + sizeof(stack), keyPad, KEY_COUNT);
+    for (uint64_t word : words)
+    {
+        hash = Mix(hash ^ word);
+    }
+    return hash;
+}
+
+uint64_t Chip8::Hash() const
+{
+    return HashRegisters() ^ memoryHash ^ displayHash;
+}
+
+uint64_t Chip8::FullHash() const
+{
+    uint64_t hash = HashRegisters();
+    for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+    {
+        hash ^= MemoryKey(address, ReadMemory(address));
+    }
+
+    uint64_t const* pixelKeys = PixelKeys();
+    for (unsigned int i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; ++i)
+    {
+        if (display[i])
+        {
+            hash ^= pixelKeys[i];
+        }
+    }
+    return hash;
+}
+
+bool Chip8::Matches(Chip8State const& state) const
+{
+    for (unsigned int page = 0; page < PAGE_COUNT; ++page)
+    {
+        if (memcmp(memory.Page(page), state.memory + page * PAGE_SIZE, PAGE_SIZE) != 0)
+        {
+            return false;
+        }
+    }
+
+    return memcmp(registers, state.registers, sizeof(registers)) == 0
+        && index == state.index
+        && programCounter == state.programCounter
+        && memcmp(stack, state.stack, sizeof(stack)) == 0
+        && stackPointer == state.stackPointer
+        && delayTimer == state.delayTimer
+        && soundTimer == state.soundTimer
+        && randomState == state.randomState
+        && trap == state.trap
+        && memcmp(keyPad, state.keyPad, sizeof(keyPad)) == 0
+        && memcmp(display, state.display, sizeof(display)) == 0;
+}
+
+void Chip8::Seed(uint64_t seed)
+{
+    // splitmix64 step, so that nearby seeds give unrelated sequences
+    seed = Mix(seed + 0x9E3779B97F4A7C15ull);
+
+    // xorshift must never be seeded with zero
+    randomState = static_cast<uint32_t>(seed >> 32) | 1u;
+}
+
+uint8_t Chip8::NextRandom()
+{
+    // xorshift32
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState >> 24;
+}
+
+unsigned int Chip8::RunFrame(unsigned int cycles)
+{
+    UpdateTimers();
+    if (fusionEnabled && traceSink == nullptr)
+    {
+        return (this->*runFused)(cycles);
+    }
+
+    unsigned int run = 0;
+    while (run < cycles && trap == Trap::None)
+    {
+        EmulateCycle();
+        ++run;
+    }
+    return run;
+}
+
+template<typename Quirks>
+Chip8::Fusion Chip8::Decode(unsigned int pc) const
+{
+    // Sequences never wrap around the end of memory
+    if (pc > MEMORY_SIZE - 6)
+    {
+        return Fusion::None;
+    }
+
+    unsigned int first = Read<Quirks>(pc) << 8 | Read<Quirks>(pc + 1);
+    unsigned int second = Read<Quirks>(pc + 2) << 8 | Read<Quirks>(pc + 3);
+    unsigned int third = Read<Quirks>(pc + 4) << 8 | Read<Quirks>(pc + 5);
+    unsigned int skipOnVx = 0x3000u | (first & 0x0F00u);
+
+    switch (first & 0xF000u)
+    {
+        case 0x6000:
+            if ((second & 0xF000u) == 0x6000u)
+            {
+                return Fusion::LoadLoad;
+            }
+            break;
+
+        case 0x7000:
+            if ((second & 0xFF00u) == skipOnVx && (third & 0xF000u) == 0x1000u)
+            {
+                return Fusion::CountedLoop;
+            }
+            break;
+
+        case 0xA000:
+            if ((second & 0xF000u) == 0xD000u)
+            {
+                return Fusion::LoadDraw;
+            }
+            break;
+
+        case 0xF000:
+            if ((first & 0x00FFu) == 0x07u && (second & 0xFF00u) == skipOnVx && (third & 0xF000u) == 0x1000u)
+            {
+                return Fusion::TimerWait;
+            }
+            break;
+    }
+    return Fusion::None;
+}
+
+// A page whose decoded sequences are rewritten this often holds
+// self-modifying code, which decodes again after every patch
+const unsigned int PLAIN_PAGE_REWRITES = 64;
+
+Chip8::Fusion const Chip8::FusionCache::UNKNOWN_PAGE[PAGE_SIZE] = {};
+
+Chip8::Fusion Chip8::FusionCache::Learn(unsigned int address, Fusion kind)
+{
+    unsigned int page = address / PAGE_SIZE;
+    if (!(decoded & (1u << page)))
+    {
+        if (!tables[page])
+        {
+            tables[page].reset(new Fusion[PAGE_SIZE]);
+        }
+        std::fill(tables[page].get(), tables[page].get() + PAGE_SIZE, Fusion::Unknown);
+        pages[page] = tables[page].get();
+        decoded |= 1u << page;
+    }
+    tables[page][address % PAGE_SIZE] = kind;
+    return kind;
+}
+
+void Chip8::FusionCache::Forget(uint16_t forgotten)
+{
+    decoded &= ~forgotten;
+    for (unsigned int page = 0; forgotten != 0; ++page, forgotten >>= 1)
+    {
+        if (forgotten & 1u)
+        {
+            pages[page] = UNKNOWN_PAGE;
+            rewrites[page] = 0;
+        }
+    }
+}
+
+void Chip8::FusionCache::InvalidateDecoded(unsigned int address)
+{
+    // Sequences that include the byte start up to 5 bytes before it
+    uint16_t rewritten = 0;
+    for (unsigned int start = address - 5; start != address + 1; ++start)
+    {
+        unsigned int page = (start & ADDRESS_MASK) / PAGE_SIZE;
+        if (decoded & (1u << page))
+        {
+            Fusion& entry = tables[page][start % PAGE_SIZE];
+            if (entry != Fusion::Unknown)
+            {
+                rewritten |= 1u << page;
+            }
+            entry = Fusion::Unknown;
+        }
+    }
+
+    // Writes to data next to code lose nothing, so only code that ran
+    // and was then patched counts toward running a page plain
+    for (unsigned int page = 0; rewritten != 0; ++page, rewritten >>= 1)
+    {
+        if ((rewritten & 1u) && ++rewrites[page] == PLAIN_PAGE_REWRITES)
+        {
+            std::fill(tables[page].get(), tables[page].get() + PAGE_SIZE, Fusion::None);
+            decoded &= ~(1u << page);
+        }
+    }
+}
+
+// RunFrame without tracing: each step runs either one instruction or a
+// whole fused sequence. A sequence counts as all of its instructions,
+// and leaves PC, opcode and every register as running them one by one would.
+template<typename Quirks>
+unsigned int Chip8::RunFused(unsigned int cycles)
+{
+    unsigned int const requested = cycles;
+    while (cycles > 0 && trap == Trap::None)
+    {
+        unsigned int pc = programCounter & ADDRESS_MASK;
+        // Most instructions start no sequence, so that path falls through
+        Fusion kind = fusion.Lookup(pc);
+        if (__builtin_expect(kind != Fusion::None, 0))
+        {
+            if (kind == Fusion::Unknown)
+            {
+                kind = fusion.Learn(pc, Decode<Quirks>(pc));
+            }
+            if (kind != Fusion::None && cycles >= (kind == Fusion::LoadLoad || kind == Fusion::LoadDraw ? 2u : 3u))
+            {
+                cycles -= RunSequence<Quirks>(kind, pc, cycles);
+                continue;
+            }
+        }
+
+        // EmulateCycle without the trace check, dispatching directly
+        opcode = Read<Quirks>(pc) << 8 | Read<Quirks>(pc + 1);
+        programCounter = pc + 2;
+        ExecuteOpcode<Quirks>();
+        --cycles;
+    }
+    return requested - cycles;
+}
+
+// Run the fused sequence at pc, returning the instructions it stands for
+template<typename Quirks>
+unsigned int Chip8::RunSequence(Fusion kind, unsigned int pc, unsigned int cycles)
+{
+    unsigned int length = kind == Fusion::LoadLoad || kind == Fusion::LoadDraw ? 2 : 3;
+    uint16_t first = Read<Quirks>(pc) << 8 | Read<Quirks>(pc + 1);
+    uint16_t second = Read<Quirks>(pc + 2) << 8 | Read<Quirks>(pc + 3);
+    uint16_t third = Read<Quirks>(pc + 4) << 8 | Read<Quirks>(pc + 5);
+    uint8_t& vx = registers[(first & 0x0F00u) >> 8u];
+
+    switch (kind)
+    {
+        case Fusion::LoadLoad:
+            vx = first & 0x00FFu;
+            registers[(second & 0x0F00u) >> 8u] = second & 0x00FFu;
+            opcode = second;
+            programCounter = pc + 4;
+            break;
+
+        case Fusion::CountedLoop:
+            vx += first & 0x00FFu;
+            if (vx == (second & 0x00FFu))
+            {
+                // The skip jumps over 1NNN, so it never runs
+                opcode = second;
+                programCounter = pc + 6;
+                length = 2;
+                break;
+            }
+            opcode = third;
+            programCounter = third & 0x0FFFu;
+            break;
+
+        case Fusion::LoadDraw:
+            index = first & 0x0FFFu;
+            opcode = second;
+            programCounter = pc + 4;
+            OP_DXYN<Quirks>();
+            break;
+
+        case Fusion::TimerWait:
+            vx = delayTimer;
+            if (vx == (second & 0x00FFu))
+            {
+                opcode = second;
+                programCounter = pc + 6;
+                length = 2;
+                break;
+            }
+            opcode = third;
+            programCounter = third & 0x0FFFu;
+
+            // A loop back onto itself spins until the next frame, since
+            // the delay timer cannot change before then
+            if (programCounter == pc)
+            {
+                return cycles - cycles % length;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return length;
 }
 
 void Chip8::EmulateCycle() {
-    opcode = memory[programCounter] << 8 | memory[programCounter + 1];  
-	programCounter += 2;
-	ExecuteOpcode();
+    // A trapped machine stays stopped until it is reset
+    if (trap != Trap::None)
+    {
+        return;
+    }
+    (this->*step)();
+}
+
+template<typename Quirks>
+void Chip8::Step() {
+    // Addresses wrap at 12 bits, so a PC running past 0xFFF continues at 0
+    uint16_t pc = programCounter & ADDRESS_MASK;
+    opcode = Read<Quirks>(pc) << 8 | Read<Quirks>(pc + 1);
+	programCounter = pc + 2;
+
+	if (traceSink != nullptr)
+	{
+		ExecuteTraced<Quirks>(pc);
+		return;
+	}
+
+	ExecuteOpcode<Quirks>();
+}
+
+// Execute the fetched opcode and record what it changed
+template<typename Quirks>
+void Chip8::ExecuteTraced(uint16_t pc) {
+    uint8_t before[REGISTER_COUNT];
+    memcpy(before, registers, sizeof(before));
+    uint16_t indexBefore = index;
+
+    ExecuteOpcode<Quirks>();
+
+    TraceRecord record;
+    record.pc = pc;
+    record.opcode = opcode;
+    for (unsigned int i = 0; i < REGISTER_COUNT; ++i)
+    {
+        if (registers[i] != before[i])
+        {
+            record.changedRegisters |= 1u << i;
+            record.registers[i] = registers[i];
+        }
+    }
+    record.indexChanged = index != indexBefore;
+    record.index = index;
+
+    traceSink->Push(record);
+}
+
+void Chip8::RaiseTrap(Trap reason) {
+    trap = reason;
+    trapAddress = programCounter - 2;
+}
+
+char const* TrapName(Trap trap) {
+    switch (trap)
+    {
+        case Trap::None:
+            return "none";
+        case Trap::UnknownOpcode:
+            return "unknown opcode";
+        case Trap::StackOverflow:
+            return "stack overflow";
+        case Trap::StackUnderflow:
+            return "stack underflow";
+    }
+    return "unknown";
+}
+
+void Chip8::UpdateTimers() {
 	if (delayTimer > 0)
 	{
 		--delayTimer;
@@ -103,6 +765,7 @@ void Chip8::EmulateCycle() {
 	}
 }
 
+template<typename Quirks>
 void Chip8::ExecuteOpcode() {
      switch(opcode & 0xF000){
 
@@ -117,8 +780,7 @@ void Chip8::ExecuteOpcode() {
                     OP_00EE();
                     break;
                 default:
-                    printf("\nUnknown opcode: %.4X\n", opcode);
-                    exit(3);
+                    RaiseTrap(Trap::UnknownOpcode);
             }
             break;
 
@@ -159,15 +821,15 @@ void Chip8::ExecuteOpcode() {
 		    break;
 
                 case 0x0001:
-                    OP_8XY1();
+                    OP_8XY1<Quirks>();
 		    break;
 
                 case 0x0002:
-                    OP_8XY2();
+                    OP_8XY2<Quirks>();
 		    break;
 
                 case 0x0003:
-                    OP_8XY3();
+                    OP_8XY3<Quirks>();
 		    break;
 
                 case 0x0004:
@@ -179,7 +841,7 @@ void Chip8::ExecuteOpcode() {
 		    break;
 
                 case 0x0006:
-                    OP_8XY6();
+                    OP_8XY6<Quirks>();
 		    break;
 
                 case 0x0007:
@@ -187,12 +849,11 @@ void Chip8::ExecuteOpcode() {
 		    break;
 
                 case 0x000E:
-                    OP_8XYE();
+                    OP_8XYE<Quirks>();
 		    break;
 
                 default:
-                    printf("\nUnknown op code: %.4X\n", opcode);
-                    exit(3);
+                    RaiseTrap(Trap::UnknownOpcode);
             }
             break;
 
@@ -205,7 +866,7 @@ void Chip8::ExecuteOpcode() {
 	    break;
 
         case 0xB000:
-            OP_BNNN();
+            OP_BNNN<Quirks>();
 	    break;
 
         case 0xC000:
@@ -213,7 +874,7 @@ void Chip8::ExecuteOpcode() {
 	    break;
 
         case 0xD000:
-            OP_DXYN();
+            OP_DXYN<Quirks>();
 	    break;
 
         // EX__
@@ -229,8 +890,7 @@ void Chip8::ExecuteOpcode() {
 		    break;
 
                 default:
-                    printf("\nUnknown op code: %.4X\n", opcode);
-                    exit(3);
+                    RaiseTrap(Trap::UnknownOpcode);
             }
             break;
 
@@ -263,25 +923,24 @@ void Chip8::ExecuteOpcode() {
 		    break;
 
                 case 0x0033:
-                    OP_FX33();
+                    OP_FX33<Quirks>();
 		    break;
 
                 case 0x0055:
-                    OP_FX55();
+                    OP_FX55<Quirks>();
 		    break;
 
                 case 0x0065:
-                    OP_FX65();
+                    OP_FX65<Quirks>();
 		    break;
 
                 default:
-                    printf ("Unknown opcode [0xF000]: 0x%X\n", opcode);
+                    RaiseTrap(Trap::UnknownOpcode);
             }
         break;
 
         default:
-            printf("\nUnimplemented op code: %.4X\n", opcode);
-            exit(3);
+            RaiseTrap(Trap::UnknownOpcode);
 }
 }
 
@@ -289,13 +948,20 @@ void Chip8::ExecuteOpcode() {
 void Chip8::OP_00E0()
 {
 	memset(display, 0, sizeof(display));
+	displayHash = 0;
+	dirtyRows = ALL_DISPLAY_ROWS;
 }
 
 // 00EE - Return from subroutine
 void Chip8::OP_00EE()
 {
+    if (stackPointer == 0)
+    {
+        RaiseTrap(Trap::StackUnderflow);
+        return;
+    }
 	--stackPointer;
-	programCounter = stack[stackPointer];
+	programCounter = stack[stackPointer & STACK_MASK];
 }
 
 // 1NNN - Jumps to address NNN
@@ -309,7 +975,12 @@ void Chip8::OP_1NNN()
 void Chip8::OP_2NNN()
 {
     uint16_t counter = opcode & 0x0FFFu;
-    stack[stackPointer] = programCounter;
+    if (stackPointer == STACK_LEVELS)
+    {
+        RaiseTrap(Trap::StackOverflow);
+        return;
+    }
+    stack[stackPointer & STACK_MASK] = programCounter;
 	++stackPointer;
 	programCounter = counter;
 }
@@ -369,27 +1040,42 @@ void Chip8::OP_8XY0()
 }
 
 // 8XY1 - Sets VX to (VX OR VY).
+template<typename Quirks>
 void Chip8::OP_8XY1()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
     registers[Vx] |= registers[Vy];
+    if (Quirks::resetFlag)
+    {
+        registers[0xF] = 0;
+    }
 }
 
 // 8XY2 - Sets VX to (VX AND VY).
+template<typename Quirks>
 void Chip8::OP_8XY2()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
     registers[Vx] &= registers[Vy];
+    if (Quirks::resetFlag)
+    {
+        registers[0xF] = 0;
+    }
 }
 
 // 8XY3 - Sets VX to (VX XOR VY).
+template<typename Quirks>
 void Chip8::OP_8XY3()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
     registers[Vx] ^= registers[Vy];
+    if (Quirks::resetFlag)
+    {
+        registers[0xF] = 0;
+    }
 }
 
 // 8XY4 - Adds VY to VX. VF is set to 1 when there's a carry,
@@ -399,13 +1085,9 @@ void Chip8::OP_8XY4()
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
     uint16_t result = registers[Vx]+registers[Vy];
-    if(result > 0x00FFu) {
-        registers[0xF] = 1;
-    }
-    else {
-        registers[0xF] = 0;
-    }
+    // VF is written last, so the flag wins when X is F
     registers[Vx] = result & (0xFFu);
+    registers[0xF] = result > 0x00FFu ? 1 : 0;
 }
 
 // 8XY5 - VY is subtracted from VX. VF is set to 0 when
@@ -414,25 +1096,22 @@ void Chip8::OP_8XY5()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
-    if (registers[Vx] > registers[Vy])
-	{
-		registers[0xF] = 1;
-	}
-	else
-	{
-		registers[0xF] = 0;
-	}
-
+    // No borrow when the operands are equal
+    uint8_t flag = registers[Vx] >= registers[Vy] ? 1 : 0;
 	registers[Vx] -= registers[Vy];
+	registers[0xF] = flag;
 }
 
-// 0x8XY6 - Shifts VX right by one. VF is set to the value of
-// the least significant bit of VX before the shift.
+// 0x8XY6 - Shifts VX (or VY, depending on the profile) right by one
+// into VX. VF is set to the least significant bit before the shift.
+template<typename Quirks>
 void Chip8::OP_8XY6()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-    registers[0xF] = registers[Vx] & 0x1u;
-    registers[Vx] >>= 1;
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+    uint8_t value = registers[Quirks::shiftUsesVy ? Vy : Vx];
+    registers[Vx] = value >> 1;
+    registers[0xF] = value & 0x1u;
 }
 
 // 0x8XY7: Sets VX to VY minus VX. VF is set to 0 when there's
@@ -441,24 +1120,21 @@ void Chip8::OP_8XY7()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t Vy = (opcode & 0x00F0u) >> 4u;
-    if (registers[Vy] > registers[Vx])
-	{
-		registers[0xF] = 1;
-	}
-	else
-	{
-		registers[0xF] = 0;
-	}
+    uint8_t flag = registers[Vy] >= registers[Vx] ? 1 : 0;
     registers[Vx] = registers[Vy] - registers[Vx];
+    registers[0xF] = flag;
 }
 
-// 0x8XYE: Shifts VX left by one. VF is set to the value of
-// the most significant bit of VX before the shift.
+// 0x8XYE: Shifts VX (or VY, depending on the profile) left by one
+// into VX. VF is set to the most significant bit before the shift.
+template<typename Quirks>
 void Chip8::OP_8XYE()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
-    registers[0xF] = (registers[Vx] & 0x80u) >> 7u;
-    registers[Vx] <<= 1;
+    uint8_t Vy = (opcode & 0x00F0u) >> 4u;
+    uint8_t value = registers[Quirks::shiftUsesVy ? Vy : Vx];
+    registers[Vx] = value << 1;
+    registers[0xF] = (value & 0x80u) >> 7u;
 }
 
 // 9XY0 - Skips the next instruction if VX doesn't equal VY.
@@ -479,11 +1155,14 @@ void Chip8::OP_ANNN()
     index = value;
 }
 
-// BNNN - Jumps to the address NNN plus V0.
+// BNNN - Jumps to the address NNN plus V0, or to XNN plus VX
+// on CHIP-48 and SUPER-CHIP.
+template<typename Quirks>
 void Chip8::OP_BNNN()
 {
-    uint8_t value = (opcode & 0x0FFFu);
-    programCounter = registers[0] + value;
+    uint16_t value = (opcode & 0x0FFFu);
+    uint8_t Vx = Quirks::jumpUsesVx ? (opcode & 0x0F00u) >> 8u : 0;
+    programCounter = registers[Vx] + value;
 }
 
 // CXNN - Sets VX to a random number, masked by NN.
@@ -491,7 +1170,7 @@ void Chip8::OP_CXKK()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t value = (opcode & 0x00FFu);
-    registers[Vx] = (rand() % (0xFF + 1)) & value;
+    registers[Vx] = NextRandom() & value;
 }
 
 // DXYN: Draws a sprite at coordinate (VX, VY) that has a width of 8
@@ -501,33 +1180,53 @@ void Chip8::OP_CXKK()
 // I value doesn't change after the execution of this instruction.
 // VF is set to 1 if any screen pixels are flipped from set to unset
 // when the sprite is drawn, and to 0 if that doesn't happen. 
+template<typename Quirks>
 void Chip8::OP_DXYN()
 {
 	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 	uint8_t Vy = (opcode & 0x00F0u) >> 4u;
 	uint8_t height = opcode & 0x000Fu;
 
-	// Wrap if going beyond screen boundaries
-	uint8_t xPos = registers[Vx];
-	uint8_t yPos = registers[Vy];
+	// The start position always wraps. Pixels going beyond screen
+	// boundaries wrap or are clipped, depending on the profile.
+	uint8_t xPos = registers[Vx] % DISPLAY_WIDTH;
+	uint8_t yPos = registers[Vy] % DISPLAY_HEIGHT;
+
+	unsigned int rows = height;
+	unsigned int columns = 8;
+	if (!Quirks::wrapSprites)
+	{
+		rows = std::min(rows, DISPLAY_HEIGHT - yPos);
+		columns = std::min(columns, DISPLAY_WIDTH - xPos);
+	}
 
+	uint64_t const* pixelKeys = PixelKeys();
 	registers[0xF] = 0;
 
-	for (int yline = 0; yline < height; yline++)
+	for (unsigned int yline = 0; yline < rows; yline++)
             {
-                uint8_t pixel = memory[index + yline];
+                uint8_t pixel = Read<Quirks>(index + yline);
+                if (pixel != 0)
+                {
+                    dirtyRows |= 1u << ((yPos + yline) % DISPLAY_HEIGHT);
+                }
 
-                for(int xline = 0; xline < 8; xline++)
+                // Branch free, since sprite bits are as good as random
+                // to the branch predictor
+                uint32_t* row = display + (yPos + yline) % DISPLAY_HEIGHT * DISPLAY_WIDTH;
+                uint64_t const* rowKeys = pixelKeys + (yPos + yline) % DISPLAY_HEIGHT * DISPLAY_WIDTH;
+                uint32_t collision = 0;
+                uint64_t hash = 0;
+                for(unsigned int xline = 0; xline < columns; xline++)
                 {
-                    if((pixel & (0x80 >> xline)) != 0)
-                    {
-                        if(display[(xPos + xline + ((yPos + yline) * 64))] == 1)
-                        {
-                            registers[0xF] = 1;
-                        }
-                        display[xPos + xline + ((yPos + yline) * 64)] ^= 1;
-                    }
+                    uint32_t bit = (pixel >> (7 - xline)) & 1u;
+                    unsigned int x = (xPos + xline) % DISPLAY_WIDTH;
+                    collision |= row[x] & bit;
+                    row[x] ^= bit;
+                    hash ^= rowKeys[x] & (0 - static_cast<uint64_t>(bit));
                 }
+                displayHash ^= hash;
+                registers[0xF] |= collision;
             }
 }
 
@@ -537,7 +1236,7 @@ void Chip8::OP_EX9E()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
-    if(keyPad[registers[Vx]])
+    if(keyPad[registers[Vx] & 0xFu])
     {
         programCounter +=2;
     }
@@ -549,7 +1248,7 @@ void Chip8::OP_EXA1()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     
-    if(!keyPad[registers[Vx]])
+    if(!keyPad[registers[Vx] & 0xFu])
     {
         programCounter +=2;
     }
@@ -673,32 +1372,55 @@ void Chip8::OP_FX29()
 
 // FX33 - Stores the Binary-coded decimal representation of VX
 // at the addresses I, I plus 1, and I plus 2
+template<typename Quirks>
 void Chip8::OP_FX33()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
     uint8_t value = registers[Vx];
 
-	 memory[index] = Vx % 1000 / 100;
-    memory[index + 1] = Vx % 100 / 10;
-    memory[index + 2] = Vx % 10;
+    Write<Quirks>(index, value / 100);
+    Write<Quirks>(index + 1, value / 10 % 10);
+    Write<Quirks>(index + 2, value % 10);
 }
 
-// FX55 - Stores V0 to VX in memory starting at address I            
+// FX55 - Stores V0 to VX in memory starting at address I.
+// Some profiles leave I past the stored registers.
+template<typename Quirks>
 void Chip8::OP_FX55()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 	for (uint8_t i =0; i<= Vx;++i)
     {
-        memory[index +i] = registers[i]; 
+        Write<Quirks>(index + i, registers[i]);
+    }
+
+    if (Quirks::indexIncrement == IndexIncrement::ByX)
+    {
+        index += Vx;
+    }
+    else if (Quirks::indexIncrement == IndexIncrement::ByXPlusOne)
+    {
+        index += Vx + 1;
     }
 }
 
-// FX65 - Reads V0 to VX in memory starting at address I   
+// FX65 - Reads V0 to VX in memory starting at address I.
+// Some profiles leave I past the loaded registers.
+template<typename Quirks>
 void Chip8::OP_FX65()
 {
     uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 	for (uint8_t i =0; i<= Vx;++i)
     {
-        registers[i]= memory[index +i]; 
+        registers[i] = Read<Quirks>(index + i);
+    }
+
+    if (Quirks::indexIncrement == IndexIncrement::ByX)
+    {
+        index += Vx;
+    }
+    else if (Quirks::indexIncrement == IndexIncrement::ByXPlusOne)
+    {
+        index += Vx + 1;
     }
 }
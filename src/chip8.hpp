@@ -1,25 +1,282 @@
+#pragma once
+
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <random>
+#include "quirks.hpp"
 
 const unsigned int MEMORY_SIZE = 4096;
+const unsigned int PAGE_SIZE = 256;
+const unsigned int PAGE_COUNT = MEMORY_SIZE / PAGE_SIZE;
 const unsigned int REGISTER_COUNT = 16;
 const unsigned int STACK_LEVELS = 16;
 const unsigned int KEY_COUNT = 16;
+const unsigned int ADDRESS_MASK = MEMORY_SIZE - 1;
+const unsigned int STACK_MASK = STACK_LEVELS - 1;
 const unsigned int DISPLAY_HEIGHT = 32;
 const unsigned int DISPLAY_WIDTH = 64;
+const unsigned int TIMER_FREQUENCY = 60;
+const unsigned int DEFAULT_CYCLES_PER_FRAME = 14;
+// One bit per display row
+const uint32_t ALL_DISPLAY_ROWS = 0xFFFFFFFFu;
+static_assert(DISPLAY_HEIGHT == 32, "dirty rows are tracked in a 32-bit mask");
+// One bit per memory page
+const uint16_t ALL_MEMORY_PAGES = 0xFFFFu;
+static_assert(PAGE_COUNT == 16, "memory pages are tracked in a 16-bit mask");
+
+// Reasons a machine stops, in place of crashing the host process
+enum class Trap : uint8_t
+{
+	None,
+	UnknownOpcode,
+	StackOverflow,
+	StackUnderflow
+};
+
+char const* TrapName(Trap trap);
 
-class Chip8
+class TraceSink;
+class RomPack;
+struct RomPackEntry;
+
+// Machine state apart from memory. Machines keep memory separately, so
+// that those sharing a snapshot's memory carry no copy of it.
+struct Chip8Core
+{
+    uint8_t registers[REGISTER_COUNT]{};
+    uint16_t index{};
+    uint16_t programCounter{};
+    uint16_t stack[STACK_LEVELS]{};
+    uint8_t stackPointer{};
+    uint8_t delayTimer{};
+    uint8_t soundTimer{};
+    uint16_t opcode{};
+    uint32_t randomState{};
+    Trap trap{};
+    uint16_t trapAddress{};
+    // Memory pages written since the state was last marked clean
+    uint16_t dirtyPages{};
+    // Running XOR hashes, updated on every memory write and pixel flip
+    uint64_t memoryHash{};
+    uint64_t displayHash{};
+    uint8_t keyPad[KEY_COUNT]{};
+    uint32_t display[DISPLAY_HEIGHT * DISPLAY_WIDTH]{};
+};
+
+// Complete machine state. Kept trivially copyable so that saving or
+// restoring a snapshot is a single copy.
+struct Chip8State : Chip8Core
+{
+    uint8_t memory[MEMORY_SIZE]{};
+};
+
+class Chip8 : private Chip8Core
 {
 public:
 	Chip8();
+	// A machine as LoadShared leaves it, which never allocates memory of
+	// its own unless it is made private
+	explicit Chip8(Chip8State const& shared);
 	void init();
-	void LoadROM(char const* filename);
+	bool LoadROM(char const* filename);
+	bool LoadROM(uint8_t const* data, size_t size);
+	// Loads straight from the pack's mapping; the metadata is left to the caller
+	bool LoadROM(RomPack const& pack, RomPackEntry const& entry);
 	void EmulateCycle();
-	uint8_t keyPad[16]{};
-    uint32_t display[DISPLAY_HEIGHT * DISPLAY_WIDTH]{};
+	// Decrement the delay and sound timers, called at TIMER_FREQUENCY
+	void UpdateTimers();
+	// One 60 Hz frame: tick the timers, then run the given number of
+	// cycles. Returns the instructions run, fewer only if the machine traps.
+	unsigned int RunFrame(unsigned int cycles);
+	// Select how ambiguous instructions behave
+	void SetQuirkProfile(QuirkProfile profile);
+	QuirkProfile GetQuirkProfile() const { return quirkProfile; }
+	// Let RunFrame execute common instruction sequences as one fused step,
+	// with the same result. On by default. EmulateCycle, tracing and the
+	// debugger always run one instruction at a time.
+	void SetFusion(bool enabled) { fusionEnabled = enabled; }
+	bool GetFusion() const { return fusionEnabled; }
+	// Record every executed instruction to the sink, or stop with nullptr
+	void SetTraceSink(TraceSink* sink) { traceSink = sink; }
+	// Seed the random number generator used by CXKK
+	void Seed(uint64_t seed);
+	uint8_t GetSoundTimer() const { return soundTimer; }
+	Trap GetTrap() const { return trap; }
+	// Address of the instruction that raised the trap
+	uint16_t GetTrapAddress() const { return trapAddress; }
+
+	// Shared pages are copied into the snapshot, so it is always complete
+	void SaveState(Chip8State& state) const;
+	void LoadState(Chip8State const& state);
+	// Everything but memory, which ReadMemory and SaveState see
+	Chip8Core const& GetState() const { return *this; }
+	// Restore a snapshot copying only the memory pages written since the
+	// last restore. The snapshot must be the one last restored, with no
+	// dirty pages of its own. Shared pages are made private.
+	void RestoreDirty(Chip8State const& state);
+	void MarkClean() { dirtyPages = 0; }
+	// Restore a snapshot without copying its memory. Every page is read
+	// from the snapshot in place until the program first writes to it,
+	// which copies that page into this machine. Many machines can share
+	// one snapshot, which must stay alive and unchanged meanwhile.
+	// LoadState and RestoreDirty make every page private again.
+	void LoadShared(Chip8State const& state);
+	// Pages still read from the shared snapshot, one bit per page
+	uint16_t GetSharedPages() const { return memory.SharedPages(); }
+
+	// Every access is masked to 12 bits, so no address a ROM can
+	// produce reaches outside memory and no bounds check is needed
+	uint8_t ReadMemory(unsigned int address) const
+	{
+		address &= ADDRESS_MASK;
+		return memory.Page(address / PAGE_SIZE)[address % PAGE_SIZE];
+	}
+
+	// Hash of the whole machine state, from the running memory and
+	// display hashes plus the small registers. Equal states hash equal,
+	// so it serves as a loop detector or transposition key.
+	uint64_t Hash() const;
+	// The same value computed from scratch, for checking Hash()
+	uint64_t FullHash() const;
+	// Exact comparison of everything Hash() covers
+	bool Matches(Chip8State const& state) const;
+
+	// Display rows changed since the last call, one bit per row. Drawing
+	// and clearing mark rows; loading a state marks them all.
+	uint32_t TakeDirtyRows() { uint32_t rows = dirtyRows; dirtyRows = 0; return rows; }
+
+	using Chip8Core::keyPad;
+	using Chip8Core::display;
 
 private:
+    // Instruction sequences that RunFrame executes as one step
+    enum class Fusion : uint8_t
+    {
+        Unknown,     // Not decoded since the page last changed
+        None,
+        LoadLoad,    // 6XKK 6YKK
+        CountedLoop, // 7XKK 3XKK 1NNN
+        LoadDraw,    // ANNN DXYN
+        TimerWait    // FX07 3XKK 1NNN
+    };
+
+    // Decoded sequences for the code pages RunFrame has run, one table
+    // per page allocated the first time. The tables only cache what
+    // memory holds, so a copy of a machine starts without any.
+    class FusionCache
+    {
+    public:
+        FusionCache() { Forget(ALL_MEMORY_PAGES); }
+        FusionCache(FusionCache const&) : FusionCache() {}
+        FusionCache& operator=(FusionCache const&) { Forget(ALL_MEMORY_PAGES); return *this; }
+
+        // The sequence starting at an address. Pages not decoded yet read
+        // as Unknown and pages whose code keeps being rewritten as None,
+        // so the lookup never branches on the page.
+        Fusion Lookup(unsigned int address) const { return pages[address / PAGE_SIZE][address % PAGE_SIZE]; }
+        // Record a sequence Lookup returned Unknown for
+        Fusion Learn(unsigned int address, Fusion kind);
+        // Drop everything known about pages whose contents were replaced
+        void Forget(uint16_t forgotten);
+        // Forget the sequences a written byte is part of. Only writes
+        // near decoded code pay more than a mask test.
+        void Invalidate(unsigned int address)
+        {
+            unsigned int start = (address - 5) & ADDRESS_MASK;
+            if (decoded & (1u << (start / PAGE_SIZE) | 1u << (address / PAGE_SIZE)))
+            {
+                InvalidateDecoded(address);
+            }
+        }
+
+    private:
+        void InvalidateDecoded(unsigned int address);
+
+        static Fusion const UNKNOWN_PAGE[PAGE_SIZE];
+        // Either UNKNOWN_PAGE or the page's own table
+        Fusion const* pages[PAGE_COUNT];
+        std::unique_ptr<Fusion[]> tables[PAGE_COUNT];
+        uint16_t decoded{};
+        // Decoded sequences each page has lost to writes
+        uint8_t rewrites[PAGE_COUNT]{};
+    };
+
+    // Memory as one private block, or as pages read in place from a
+    // shared snapshot until the first write copies one. Both are
+    // allocated on first use, so a machine that only ever shares holds
+    // just the pages it wrote. A copy of a machine gets its own.
+    class PagedMemory
+    {
+    public:
+        PagedMemory() = default;
+        PagedMemory(PagedMemory const& other) { *this = other; }
+        PagedMemory& operator=(PagedMemory const& other);
+
+        bool Shared() const { return snapshot != nullptr; }
+        uint16_t SharedPages() const { return sharedPages; }
+        // Private memory, contiguous
+        uint8_t* Block() const { return block.get(); }
+        // Where a page is read from, in either mode
+        uint8_t const* Page(unsigned int page) const { return pages[page]; }
+        // A page of shared memory to write to, copied on first use
+        uint8_t* WritablePage(unsigned int page)
+        {
+            if (sharedPages & (1u << page))
+            {
+                Unshare(page);
+            }
+            return copies[page].get();
+        }
+        // Switch to private memory, carrying the contents over only if
+        // asked, and return the block
+        uint8_t* MakePrivate(bool keepContents);
+        // Read every page from the snapshot
+        void Share(uint8_t const* snapshot);
+
+    private:
+        void Unshare(unsigned int page);
+
+        std::unique_ptr<uint8_t[]> block;
+        uint8_t const* pages[PAGE_COUNT]{};
+        // With shared memory: the snapshot, this machine's copies of the
+        // pages it wrote, and the pages still read from the snapshot
+        uint8_t const* snapshot{};
+        std::unique_ptr<uint8_t[]> copies[PAGE_COUNT];
+        uint16_t sharedPages{};
+    };
+
+    // Point step and runFused at the instantiations for the profile and
+    // for where memory is read from
+    void SelectHandlers();
+    template<typename Quirks>
+    void SelectHandlers();
+    template<typename Quirks>
+    void Step();
+    template<typename Quirks>
     void ExecuteOpcode();
+    template<typename Quirks>
+    unsigned int RunFused(unsigned int cycles);
+    template<typename Quirks>
+    unsigned int RunSequence(Fusion kind, unsigned int pc, unsigned int cycles);
+    template<typename Quirks>
+    Fusion Decode(unsigned int pc) const;
+    template<typename Quirks>
+    void ExecuteTraced(uint16_t pc);
+    uint8_t NextRandom();
+    void RaiseTrap(Trap reason);
+
+    // Memory access compiled for private or shared memory, as the
+    // handlers were selected
+    template<typename Quirks>
+    uint8_t Read(unsigned int address) const;
+    template<typename Quirks>
+    void Write(unsigned int address, uint8_t value);
+    // Restore everything but memory from a snapshot
+    void CopyCore(Chip8State const& state);
+
+    static uint64_t MemoryKey(unsigned int address, uint8_t value);
+    uint64_t HashRegisters() const;
 	// Do nothing
 	void OP_NULL();
 
@@ -54,12 +311,15 @@ private:
 	void OP_8XY0();
 
 	// OR Vx, Vy
+	template<typename Quirks>
 	void OP_8XY1();
 
 	// AND Vx, Vy
+	template<typename Quirks>
 	void OP_8XY2();
 
 	// XOR Vx, Vy
+	template<typename Quirks>
 	void OP_8XY3();
 
 	// ADD Vx, Vy
@@ -69,12 +329,14 @@ private:
 	void OP_8XY5();
 
 	// SHR Vx
+	template<typename Quirks>
 	void OP_8XY6();
 
 	// SUBN Vx, Vy
 	void OP_8XY7();
 
 	// SHL Vx
+	template<typename Quirks>
 	void OP_8XYE();
 
 	// SNE Vx, Vy
@@ -84,12 +346,14 @@ private:
 	void OP_ANNN();
 
 	// JP V0, address
+	template<typename Quirks>
 	void OP_BNNN();
 
 	// RND Vx, byte
 	void OP_CXKK();
 
 	// DRW Vx, Vy, height
+	template<typename Quirks>
 	void OP_DXYN();
 
 	// SKP Vx
@@ -117,21 +381,24 @@ private:
 	void OP_FX29();
 
 	// LD B, Vx
+	template<typename Quirks>
 	void OP_FX33();
 
 	// LD [I], Vx
+	template<typename Quirks>
 	void OP_FX55();
 
 	// LD Vx, [I]
+	template<typename Quirks>
 	void OP_FX65();
 
-    uint8_t registers[REGISTER_COUNT]{};
-    uint8_t memory[MEMORY_SIZE]{};
-    uint16_t index{};
-    uint16_t programCounter{};
-    uint16_t stack[STACK_LEVELS]{};
-    uint8_t stackPointer{};
-    uint8_t delayTimer{};
-    uint8_t soundTimer{};
-    uint16_t opcode{};
+    // Instantiations of Step and RunFused for the selected profile
+    void (Chip8::*step)();
+    unsigned int (Chip8::*runFused)(unsigned int);
+    QuirkProfile quirkProfile;
+    TraceSink* traceSink{};
+    uint32_t dirtyRows{ALL_DISPLAY_ROWS};
+    bool fusionEnabled{true};
+    FusionCache fusion;
+    PagedMemory memory;
 };
@@ -0,0 +1,377 @@
+#include "debugger.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "timing.hpp"
+
+static bool SetBit(uint64_t* bitmap, uint16_t address, bool value)
+{
+	address &= ADDRESS_MASK;
+	uint64_t bit = uint64_t(1) << (address % 64);
+	bool wasSet = (bitmap[address / 64] & bit) != 0;
+
+	if (value)
+	{
+		bitmap[address / 64] |= bit;
+	}
+	else
+	{
+		bitmap[address / 64] &= ~bit;
+	}
+	return wasSet;
+}
+
+void Debugger::AddBreakpoint(uint16_t address)
+{
+	if (!SetBit(breakpoints, address, true))
+	{
+		++breakpointCount;
+	}
+}
+
+void Debugger::RemoveBreakpoint(uint16_t address)
+{
+	if (SetBit(breakpoints, address, false))
+	{
+		--breakpointCount;
+	}
+}
+
+void Debugger::AddWatchpoint(uint16_t address, unsigned int length)
+{
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (!SetBit(watchpoints, address + i, true))
+		{
+			++watchpointCount;
+		}
+	}
+}
+
+void Debugger::RemoveWatchpoint(uint16_t address, unsigned int length)
+{
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (SetBit(watchpoints, address + i, false))
+		{
+			--watchpointCount;
+		}
+	}
+}
+
+void Debugger::AddCondition(RegisterCondition const& condition)
+{
+	conditions.push_back(condition);
+	conditionHeld.push_back(false);
+}
+
+void Debugger::ClearConditions()
+{
+	conditions.clear();
+	conditionHeld.clear();
+}
+
+bool Debugger::Watched(uint16_t address, unsigned int length) const
+{
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		if (Test(watchpoints, address + i))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+StopReason Debugger::Check(Chip8 const& chip8)
+{
+	Chip8Core const& state = chip8.GetState();
+	uint16_t pc = state.programCounter & ADDRESS_MASK;
+
+	if (breakpointCount > 0 && Test(breakpoints, pc))
+	{
+		return StopReason::Breakpoint;
+	}
+
+	if (watchpointCount > 0)
+	{
+		uint16_t opcode = chip8.ReadMemory(pc) << 8 | chip8.ReadMemory(pc + 1);
+		uint8_t x = (opcode & 0x0F00u) >> 8u;
+
+		if ((opcode & 0xF0FFu) == 0xF033u && Watched(state.index, 3))
+		{
+			return StopReason::Watchpoint;
+		}
+		if ((opcode & 0xF0FFu) == 0xF055u && Watched(state.index, x + 1))
+		{
+			return StopReason::Watchpoint;
+		}
+	}
+
+	StopReason reason = StopReason::None;
+
+	for (size_t i = 0; i < conditions.size(); ++i)
+	{
+		RegisterCondition const& condition = conditions[i];
+		uint8_t value = state.registers[condition.reg & 0xFu];
+		bool hit = false;
+
+		switch (condition.comparison)
+		{
+			case RegisterCondition::Equal:
+				hit = value == condition.value;
+				break;
+			case RegisterCondition::NotEqual:
+				hit = value != condition.value;
+				break;
+			case RegisterCondition::Less:
+				hit = value < condition.value;
+				break;
+			case RegisterCondition::LessEqual:
+				hit = value <= condition.value;
+				break;
+			case RegisterCondition::Greater:
+				hit = value > condition.value;
+				break;
+			case RegisterCondition::GreaterEqual:
+				hit = value >= condition.value;
+				break;
+		}
+
+		// Stop when the condition becomes true, not on every
+		// instruction while it holds
+		if (hit && !conditionHeld[i])
+		{
+			reason = StopReason::Condition;
+		}
+		conditionHeld[i] = hit;
+	}
+
+	return reason;
+}
+
+StopReason Debugger::RunFrame(Chip8& chip8, FrameScheduler& scheduler)
+{
+	scheduler.BeginFrame(chip8);
+
+	while (!scheduler.FrameDone(chip8))
+	{
+		uint16_t pc = chip8.GetState().programCounter & ADDRESS_MASK;
+
+		// Don't stop again on the instruction we just stopped at
+		if (!(resuming && pc == stoppedAt))
+		{
+			StopReason reason = Check(chip8);
+			if (reason != StopReason::None)
+			{
+				resuming = true;
+				stoppedAt = pc;
+				return reason;
+			}
+		}
+		resuming = false;
+
+		scheduler.Step(chip8);
+	}
+
+	return StopReason::None;
+}
+
+static void PrintState(Chip8 const& chip8)
+{
+	Chip8Core const& state = chip8.GetState();
+	uint16_t pc = state.programCounter & ADDRESS_MASK;
+
+	std::printf("PC=%.3X [%.2X%.2X]  I=%.3X  SP=%X  DT=%.2X  ST=%.2X\n", pc,
+		chip8.ReadMemory(pc), chip8.ReadMemory(pc + 1), state.index,
+		state.stackPointer, state.delayTimer, state.soundTimer);
+
+	for (unsigned int i = 0; i < REGISTER_COUNT; ++i)
+	{
+		std::printf("V%X=%.2X%s", i, state.registers[i], i % 8 == 7 ? "\n" : "  ");
+	}
+
+	if (chip8.GetTrap() != Trap::None)
+	{
+		std::printf("Trapped: %s at %.3X\n", TrapName(chip8.GetTrap()), chip8.GetTrapAddress());
+	}
+}
+
+void Debugger::Step(Chip8& chip8, unsigned long count)
+{
+	for (unsigned long i = 0; i < count && chip8.GetTrap() == Trap::None; ++i)
+	{
+		chip8.EmulateCycle();
+	}
+	resuming = false;
+	PrintState(chip8);
+}
+
+static bool ParseCondition(std::istringstream& args, RegisterCondition& condition)
+{
+	std::string reg;
+	std::string comparison;
+	std::string value;
+	args >> reg >> comparison >> value;
+
+	if (reg.size() != 2 || (reg[0] != 'V' && reg[0] != 'v') || value.empty())
+	{
+		return false;
+	}
+
+	static struct { char const* text; RegisterCondition::Comparison comparison; } const comparisons[] =
+	{
+		{ "==", RegisterCondition::Equal },
+		{ "!=", RegisterCondition::NotEqual },
+		{ "<", RegisterCondition::Less },
+		{ "<=", RegisterCondition::LessEqual },
+		{ ">", RegisterCondition::Greater },
+		{ ">=", RegisterCondition::GreaterEqual },
+	};
+
+	for (auto const& entry : comparisons)
+	{
+		if (comparison == entry.text)
+		{
+			condition.reg = std::strtoul(reg.c_str() + 1, nullptr, 16);
+			condition.comparison = entry.comparison;
+			condition.value = std::strtoul(value.c_str(), nullptr, 16);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Debugger::Prompt(Chip8& chip8, StopReason reason)
+{
+	static char const* const reasons[] = { "Paused", "Breakpoint", "Watchpoint", "Condition" };
+	std::printf("%s\n", reasons[static_cast<int>(reason)]);
+	PrintState(chip8);
+
+	std::string line;
+	for (;;)
+	{
+		std::printf("(chip8) ");
+		std::fflush(stdout);
+
+		if (!std::getline(std::cin, line))
+		{
+			return false;
+		}
+
+		std::istringstream args(line);
+		std::string command;
+		args >> command;
+
+		std::string operand;
+		args >> operand;
+		unsigned long number = std::strtoul(operand.c_str(), nullptr, 16);
+
+		if (command == "c" || command == "continue")
+		{
+			return true;
+		}
+		else if (command == "s" || command == "step")
+		{
+			Step(chip8, operand.empty() ? 1 : std::strtoul(operand.c_str(), nullptr, 10));
+		}
+		else if (command == "b" || command == "break")
+		{
+			AddBreakpoint(number);
+		}
+		else if (command == "db")
+		{
+			RemoveBreakpoint(number);
+		}
+		else if (command == "w" || command == "watch")
+		{
+			std::string length;
+			args >> length;
+			AddWatchpoint(number, length.empty() ? 1 : std::strtoul(length.c_str(), nullptr, 10));
+		}
+		else if (command == "dw")
+		{
+			std::string length;
+			args >> length;
+			RemoveWatchpoint(number, length.empty() ? 1 : std::strtoul(length.c_str(), nullptr, 10));
+		}
+		else if (command == "cond")
+		{
+			RegisterCondition condition;
+			std::istringstream conditionArgs(line);
+			conditionArgs >> command;
+			if (ParseCondition(conditionArgs, condition))
+			{
+				AddCondition(condition);
+			}
+			else
+			{
+				std::printf("Expected: cond V<x> <==|!=|<|<=|>|>=> <hex value>\n");
+			}
+		}
+		else if (command == "dc")
+		{
+			ClearConditions();
+		}
+		else if (command == "r" || command == "regs")
+		{
+			PrintState(chip8);
+		}
+		else if (command == "m" || command == "mem")
+		{
+			std::string length;
+			args >> length;
+			unsigned long count = length.empty() ? 16 : std::strtoul(length.c_str(), nullptr, 10);
+			for (unsigned long i = 0; i < count; ++i)
+			{
+				uint16_t address = (number + i) & ADDRESS_MASK;
+				if (i % 16 == 0)
+				{
+					std::printf("%s%.3X:", i ? "\n" : "", address);
+				}
+				std::printf(" %.2X", chip8.ReadMemory(address));
+			}
+			std::printf("\n");
+		}
+		else if (command == "l" || command == "list")
+		{
+			for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+			{
+				if (Test(breakpoints, address))
+				{
+					std::printf("break %.3X\n", address);
+				}
+				if (Test(watchpoints, address))
+				{
+					std::printf("watch %.3X\n", address);
+				}
+			}
+			for (RegisterCondition const& condition : conditions)
+			{
+				static char const* const comparisons[] = { "==", "!=", "<", "<=", ">", ">=" };
+				std::printf("cond V%X %s %.2X\n", condition.reg, comparisons[condition.comparison], condition.value);
+			}
+		}
+		else if (command == "q" || command == "quit")
+		{
+			return false;
+		}
+		else if (!command.empty())
+		{
+			std::printf(
+				"c                    continue\n"
+				"s [n]                step n instructions\n"
+				"b <addr>, db <addr>  set or delete a breakpoint\n"
+				"w <addr> [len]       watch FX33/FX55 writes, dw to delete\n"
+				"cond V<x> <op> <val> stop when a register condition holds\n"
+				"dc                   delete all conditions\n"
+				"r                    show registers\n"
+				"m <addr> [len]       dump memory\n"
+				"l                    list breakpoints, watchpoints and conditions\n"
+				"q                    quit\n");
+		}
+	}
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "chip8.hpp"
+
+enum class StopReason
+{
+	None,
+	Breakpoint,
+	Watchpoint,
+	Condition
+};
+
+// Stop when the comparison of register Vx with value becomes true
+struct RegisterCondition
+{
+	enum Comparison { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual };
+
+	uint8_t reg;
+	Comparison comparison;
+	uint8_t value;
+};
+
+class FrameScheduler;
+
+// Breakpoints, watchpoints and register conditions, with a command
+// prompt on stdin. Checks only happen in the debugger's own run loop:
+// frontends call RunFrame only while HasChecks() is true and use
+// FrameScheduler::RunFrame otherwise, so an idle debugger costs nothing.
+class Debugger
+{
+public:
+	void AddBreakpoint(uint16_t address);
+	void RemoveBreakpoint(uint16_t address);
+	// Stop before FX33/FX55 write to any address in [address, address + length)
+	void AddWatchpoint(uint16_t address, unsigned int length = 1);
+	void RemoveWatchpoint(uint16_t address, unsigned int length = 1);
+	void AddCondition(RegisterCondition const& condition);
+	void ClearConditions();
+
+	bool HasChecks() const { return breakpointCount + watchpointCount + conditions.size() > 0; }
+
+	// Like FrameScheduler::RunFrame, but stops before an instruction that
+	// hits a check. The scheduler counts the instructions run either way.
+	StopReason RunFrame(Chip8& chip8, FrameScheduler& scheduler);
+
+	// Read commands until the user continues. Returns false to quit.
+	bool Prompt(Chip8& chip8, StopReason reason);
+
+private:
+	StopReason Check(Chip8 const& chip8);
+	bool Watched(uint16_t address, unsigned int length) const;
+	void Step(Chip8& chip8, unsigned long count);
+
+	static bool Test(uint64_t const* bitmap, uint16_t address)
+	{
+		address &= ADDRESS_MASK;
+		return (bitmap[address / 64] >> (address % 64)) & 1u;
+	}
+
+	uint64_t breakpoints[MEMORY_SIZE / 64]{};
+	uint64_t watchpoints[MEMORY_SIZE / 64]{};
+	unsigned int breakpointCount{};
+	unsigned int watchpointCount{};
+	std::vector<RegisterCondition> conditions;
+	std::vector<bool> conditionHeld;
+
+	// Set when stopping, so that continuing runs the instruction stopped at
+	bool resuming{};
+	uint16_t stoppedAt{};
+};
@@ -1,8 +1,48 @@
 #include "display.hpp"
+#include "timeline.hpp"
 #include <SDL2/SDL.h>
 
+const int GLYPH_SCALE = 3;
+
+// 3x5 font, five rows of three bits from the top, for digits then letters
+const uint16_t DIGIT_GLYPHS[10] =
+{
+	0x7B6F, 0x2C97, 0x73E7, 0x73CF, 0x5BC9, 0x79CF, 0x79EF, 0x7249, 0x7BEF, 0x7BCF
+};
+const uint16_t LETTER_GLYPHS[26] =
+{
+	0x2BED, 0x6BAE, 0x3923, 0x6B6E, 0x79A7, 0x79A4, 0x396B, 0x5BED, 0x7497, 0x126A, 0x5BAD, 0x4927, 0x5FED,
+	0x6B6D, 0x2B6A, 0x6BA4, 0x2B73, 0x6BAD, 0x388E, 0x7492, 0x5B6F, 0x5B6A, 0x5BFD, 0x5AAD, 0x5A92, 0x72A7
+};
+
+static uint16_t Glyph(char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		return DIGIT_GLYPHS[c - '0'];
+	}
+	if (c >= 'A' && c <= 'Z')
+	{
+		return LETTER_GLYPHS[c - 'A'];
+	}
+	if (c >= 'a' && c <= 'z')
+	{
+		return LETTER_GLYPHS[c - 'a'];
+	}
+
+	switch (c)
+	{
+		case '.': return 0x0002;
+		case ':': return 0x0410;
+		case '%': return 0x52A5;
+		case '/': return 0x12A4;
+		case '-': return 0x01C0;
+		default: return 0;
+	}
+}
 
 Display::Display(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight)
+	: textureWidth(textureWidth), textureHeight(textureHeight)
 {
 	SDL_Init(SDL_INIT_VIDEO);
 
@@ -23,10 +63,120 @@ Display::~Display()
 	SDL_Quit();
 }
 
-void Display::Update(void const* buffer, int pitch)
+void Display::Update(void const* buffer, int pitch, uint32_t dirtyRows, char const* overlay)
+{
+	{
+		// Upload each run of consecutive dirty rows as one rectangle
+		TIMELINE_SCOPE("upload");
+		for (int row = 0; row < textureHeight && row < 32; )
+		{
+			if (!(dirtyRows & (1u << row)))
+			{
+				++row;
+				continue;
+			}
+
+			int first = row;
+			while (row < textureHeight && row < 32 && (dirtyRows & (1u << row)))
+			{
+				++row;
+			}
+
+			SDL_Rect rows = { 0, first, textureWidth, row - first };
+			SDL_UpdateTexture(texture, &rows, static_cast<uint8_t const*>(buffer) + first * pitch, pitch);
+		}
+	}
+
+	Present(overlay);
+}
+
+void Display::Update(void const* buffer, int pitch, int firstRow, int endRow, char const* overlay)
+{
+	if (firstRow < endRow)
+	{
+		TIMELINE_SCOPE("upload");
+		SDL_Rect rows = { 0, firstRow, textureWidth, endRow - firstRow };
+		SDL_UpdateTexture(texture, &rows, static_cast<uint8_t const*>(buffer) + firstRow * pitch, pitch);
+	}
+
+	Present(overlay);
+}
+
+void Display::SetHighlight(int x, int y, int width, int height)
 {
-	SDL_UpdateTexture(texture, nullptr, buffer, pitch);
-	SDL_RenderClear(renderer);
-	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+	highlightX = x;
+	highlightY = y;
+	highlightWidth = width;
+	highlightHeight = height;
+}
+
+void Display::Present(char const* overlay)
+{
+	{
+		TIMELINE_SCOPE("render");
+		SDL_RenderClear(renderer);
+		SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+		if (highlightWidth != 0)
+		{
+			DrawHighlight();
+		}
+		if (overlay != nullptr)
+		{
+			DrawText(overlay);
+		}
+	}
+
+	TIMELINE_SCOPE("present");
 	SDL_RenderPresent(renderer);
+}
+
+void Display::DrawHighlight()
+{
+	// The texture is stretched over the whole window
+	int windowWidth = 0;
+	int windowHeight = 0;
+	SDL_GetRendererOutputSize(renderer, &windowWidth, &windowHeight);
+	SDL_Rect outline = { highlightX * windowWidth / textureWidth, highlightY * windowHeight / textureHeight,
+		highlightWidth * windowWidth / textureWidth, highlightHeight * windowHeight / textureHeight };
+
+	SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
+	SDL_RenderDrawRect(renderer, &outline);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+}
+
+void Display::SetTitle(char const* title)
+{
+	SDL_SetWindowTitle(window, title);
+}
+
+void Display::DrawText(char const* text)
+{
+	int const advance = 4 * GLYPH_SCALE;
+	int length = 0;
+	while (text[length] != '\0')
+	{
+		++length;
+	}
+
+	SDL_Rect background = { 0, 0, (length + 1) * advance, 7 * GLYPH_SCALE };
+	SDL_SetRenderDrawColor(renderer, 0, 0, 128, 255);
+	SDL_RenderFillRect(renderer, &background);
+
+	SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
+	for (int i = 0; i < length; ++i)
+	{
+		uint16_t glyph = Glyph(text[i]);
+		for (int bit = 0; bit < 15; ++bit)
+		{
+			if (glyph & (0x4000u >> bit))
+			{
+				SDL_Rect pixel = { advance / 2 + i * advance + bit % 3 * GLYPH_SCALE, GLYPH_SCALE + bit / 3 * GLYPH_SCALE,
+					GLYPH_SCALE, GLYPH_SCALE };
+				SDL_RenderFillRect(renderer, &pixel);
+			}
+		}
+	}
+
+	// RenderClear uses the draw color
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 }
\ No newline at end of file
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <cstdint>
 
 class SDL_Window;
@@ -9,10 +11,29 @@ class Display
 public:
 	Display(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight);
 	~Display();
-	void Update(void const* buffer, int pitch);
+	// Uploads only the rows set in dirtyRows, one bit per texture row.
+	// Overlay text, if any, is drawn over the top left corner.
+	void Update(void const* buffer, int pitch, uint32_t dirtyRows, char const* overlay = nullptr);
+	// Uploads the rows from firstRow up to endRow as one rectangle, for
+	// textures taller than 32 rows
+	void Update(void const* buffer, int pitch, int firstRow, int endRow, char const* overlay = nullptr);
+	void SetTitle(char const* title);
+	// Outline a rectangle of the texture on every frame, or none with a
+	// zero width
+	void SetHighlight(int x, int y, int width, int height);
 
 private:
+	void Present(char const* overlay);
+	void DrawText(char const* text);
+	void DrawHighlight();
+
 	SDL_Window* window{};
 	SDL_Renderer* renderer{};
 	SDL_Texture* texture{};
+	int textureWidth{};
+	int textureHeight{};
+	int highlightX{};
+	int highlightY{};
+	int highlightWidth{};
+	int highlightHeight{};
 };
\ No newline at end of file
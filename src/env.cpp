@@ -0,0 +1,149 @@
+#include "env.hpp"
+
+static size_t ObservationSizeFor(ObservationFormat format)
+{
+	switch (format)
+	{
+		case ObservationFormat::PackedBits:
+			return DISPLAY_WIDTH * DISPLAY_HEIGHT / 8;
+		case ObservationFormat::Downsampled:
+			return (DISPLAY_WIDTH / 2) * (DISPLAY_HEIGHT / 2);
+		default:
+			return DISPLAY_WIDTH * DISPLAY_HEIGHT;
+	}
+}
+
+Env::Env(unsigned int count, ObservationFormat format, unsigned int cyclesPerFrame, QuirkProfile profile)
+	: machines(count), format(format), cyclesPerFrame(cyclesPerFrame),
+	  observationSize(ObservationSizeFor(format)), observations(count * observationSize)
+{
+	// Taken from a machine of its own, so that an empty batch has one too
+	Chip8 blank;
+	blank.MarkClean();
+	blank.SaveState(initialState);
+	for (Chip8& chip8 : machines)
+	{
+		chip8.SetQuirkProfile(profile);
+		chip8.LoadState(initialState);
+	}
+}
+
+bool Env::LoadROM(char const* filename)
+{
+	Chip8 loader;
+	if (!loader.LoadROM(filename))
+	{
+		return false;
+	}
+	Start(loader);
+	return true;
+}
+
+bool Env::LoadROM(uint8_t const* data, size_t size)
+{
+	Chip8 loader;
+	if (!loader.LoadROM(data, size))
+	{
+		return false;
+	}
+	Start(loader);
+	return true;
+}
+
+void Env::Start(Chip8& loader)
+{
+	loader.MarkClean();
+	loader.SaveState(initialState);
+
+	// Every machine must start from the new image before Reset can
+	// copy back only dirty pages
+	for (Chip8& chip8 : machines)
+	{
+		chip8.LoadState(initialState);
+	}
+
+	Reset(0);
+}
+
+void Env::Reset(uint64_t seed)
+{
+	for (unsigned int env = 0; env < machines.size(); ++env)
+	{
+		Reset(env, seed + env);
+	}
+}
+
+void Env::Reset(unsigned int env, uint64_t seed)
+{
+	machines[env].RestoreDirty(initialState);
+	machines[env].Seed(seed);
+	Observe(env);
+}
+
+void Env::Step(uint16_t const* actions, unsigned int framesPerStep)
+{
+	for (unsigned int env = 0; env < machines.size(); ++env)
+	{
+		Chip8& chip8 = machines[env];
+
+		for (unsigned int key = 0; key < KEY_COUNT; ++key)
+		{
+			chip8.keyPad[key] = (actions[env] >> key) & 1u;
+		}
+
+		for (unsigned int frame = 0; frame < framesPerStep; ++frame)
+		{
+			chip8.RunFrame(cyclesPerFrame);
+		}
+
+		Observe(env);
+	}
+}
+
+void Env::Observe(unsigned int env)
+{
+	uint32_t const* display = machines[env].display;
+	uint8_t* out = &observations[env * observationSize];
+
+	switch (format)
+	{
+		case ObservationFormat::Pixels:
+		{
+			for (unsigned int i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT; ++i)
+			{
+				out[i] = display[i] != 0;
+			}
+		}
+		break;
+
+		case ObservationFormat::PackedBits:
+		{
+			for (unsigned int i = 0; i < DISPLAY_WIDTH * DISPLAY_HEIGHT / 8; ++i)
+			{
+				uint8_t bits = 0;
+				for (unsigned int bit = 0; bit < 8; ++bit)
+				{
+					bits = (bits << 1) | (display[i * 8 + bit] != 0);
+				}
+				out[i] = bits;
+			}
+		}
+		break;
+
+		case ObservationFormat::Downsampled:
+		{
+			for (unsigned int y = 0; y < DISPLAY_HEIGHT / 2; ++y)
+			{
+				uint32_t const* top = display + (2 * y) * DISPLAY_WIDTH;
+				uint32_t const* bottom = top + DISPLAY_WIDTH;
+
+				for (unsigned int x = 0; x < DISPLAY_WIDTH / 2; ++x)
+				{
+					out[y * (DISPLAY_WIDTH / 2) + x] =
+						(top[2 * x] | top[2 * x + 1] | bottom[2 * x] | bottom[2 * x + 1]) != 0;
+				}
+			}
+		}
+		break;
+	}
+}
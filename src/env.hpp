@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "chip8.hpp"
+
+enum class ObservationFormat
+{
+	Pixels,      // One byte per pixel, 64x32
+	PackedBits,  // One bit per pixel, leftmost pixel in the high bit
+	Downsampled  // One byte per 2x2 block, 32x16, set if any pixel is set
+};
+
+// A batch of environments running the same ROM, for training agents.
+// All buffers are allocated up front: Reset and Step never allocate.
+class Env
+{
+public:
+	Env(unsigned int count, ObservationFormat format, unsigned int cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME,
+		QuirkProfile profile = DEFAULT_QUIRK_PROFILE);
+	bool LoadROM(char const* filename);
+	bool LoadROM(uint8_t const* data, size_t size);
+
+	// Restore every environment to the post-load snapshot
+	void Reset(uint64_t seed);
+	void Reset(unsigned int env, uint64_t seed);
+
+	// Hold one key bitmask per environment for framesPerStep frames,
+	// then refresh the observations
+	void Step(uint16_t const* actions, unsigned int framesPerStep);
+
+	unsigned int Count() const { return machines.size(); }
+	size_t ObservationSize() const { return observationSize; }
+	uint8_t const* Observations() const { return observations.data(); }
+	uint8_t const* GetObservation(unsigned int env) const { return &observations[env * observationSize]; }
+	Chip8 const& GetMachine(unsigned int env) const { return machines[env]; }
+
+private:
+	void Start(Chip8& loader);
+	void Observe(unsigned int env);
+
+	std::vector<Chip8> machines;
+	Chip8State initialState;
+	ObservationFormat format;
+	unsigned int cyclesPerFrame;
+	size_t observationSize;
+	std::vector<uint8_t> observations;
+};
@@ -0,0 +1,321 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "chip8.hpp"
+
+const unsigned int FUZZ_FRAMES = 30;
+const unsigned int EDGE_MAP_BITS = 16;
+const unsigned int EDGE_MAP_SIZE = 1u << EDGE_MAP_BITS;
+
+// Guest coverage seen so far over the whole campaign. Executions test
+// against it directly, so there is no per-execution map to clear.
+struct Coverage
+{
+	uint8_t pcs[MEMORY_SIZE]{};
+	uint8_t edges[EDGE_MAP_SIZE]{};
+	unsigned int pcCount{};
+	unsigned int edgeCount{};
+};
+
+struct TestCase
+{
+	std::vector<uint8_t> rom;
+	std::vector<uint16_t> inputs; // Key bitmask held during each frame
+};
+
+// Restore the snapshot, write the ROM over it and run the inputs.
+// Returns true if the run reached a PC or edge never seen before.
+static bool Execute(Chip8& chip8, Chip8State const& snapshot, TestCase const& test,
+	unsigned int cyclesPerFrame, Coverage& coverage)
+{
+	chip8.LoadState(snapshot);
+	chip8.LoadROM(test.rom.data(), test.rom.size());
+
+	bool newCoverage = false;
+	uint32_t previous = 0;
+
+	for (unsigned int frame = 0; frame < test.inputs.size(); ++frame)
+	{
+		for (unsigned int key = 0; key < KEY_COUNT; ++key)
+		{
+			chip8.keyPad[key] = (test.inputs[frame] >> key) & 1u;
+		}
+
+		chip8.UpdateTimers();
+
+		for (unsigned int i = 0; i < cyclesPerFrame; ++i)
+		{
+			uint32_t pc = chip8.GetState().programCounter & (MEMORY_SIZE - 1);
+			uint32_t edge = ((previous << 12 | pc) * 2654435761u) >> (32 - EDGE_MAP_BITS);
+			previous = pc;
+
+			if (!coverage.edges[edge])
+			{
+				coverage.edges[edge] = 1;
+				++coverage.edgeCount;
+				newCoverage = true;
+
+				if (!coverage.pcs[pc])
+				{
+					coverage.pcs[pc] = 1;
+					++coverage.pcCount;
+				}
+			}
+
+			chip8.EmulateCycle();
+			if (chip8.GetTrap() != Trap::None)
+			{
+				return newCoverage;
+			}
+		}
+	}
+
+	return newCoverage;
+}
+
+// Entry point for libFuzzer builds: the input is the ROM, run with no keys
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const* data, size_t size)
+{
+	static Chip8 chip8;
+	static Chip8State snapshot;
+	static bool saved = (chip8.SaveState(snapshot), true);
+	(void)saved;
+
+	chip8.LoadState(snapshot);
+	chip8.LoadROM(data, size);
+
+	for (unsigned int frame = 0; frame < FUZZ_FRAMES && chip8.GetTrap() == Trap::None; ++frame)
+	{
+		chip8.RunFrame(DEFAULT_CYCLES_PER_FRAME);
+	}
+
+	return 0;
+}
+
+#ifndef CHIP8_LIBFUZZER
+
+static void MutateROM(std::vector<uint8_t>& rom, std::mt19937& rng)
+{
+	if (rom.empty())
+	{
+		return;
+	}
+
+	size_t position = rng() % rom.size();
+
+	switch (rng() % 4)
+	{
+		case 0:
+		{
+			rom[position] ^= 1u << (rng() % 8);
+		}
+		break;
+
+		case 1:
+		{
+			rom[position] = rng();
+		}
+		break;
+
+		case 2:
+		{
+			// Write a whole random instruction at an aligned address
+			position &= ~static_cast<size_t>(1);
+			uint16_t instruction = rng();
+			rom[position] = instruction >> 8;
+			if (position + 1 < rom.size())
+			{
+				rom[position + 1] = instruction & 0xFFu;
+			}
+		}
+		break;
+
+		case 3:
+		{
+			rom[position] = rom[rng() % rom.size()];
+		}
+		break;
+	}
+}
+
+static void MutateInputs(std::vector<uint16_t>& inputs, std::mt19937& rng)
+{
+	size_t frame = rng() % inputs.size();
+
+	switch (rng() % 3)
+	{
+		case 0:
+		{
+			inputs[frame] ^= 1u << (rng() % KEY_COUNT);
+		}
+		break;
+
+		case 1:
+		{
+			inputs[frame] = rng();
+		}
+		break;
+
+		case 2:
+		{
+			// Hold the same keys for a run of frames
+			size_t length = 1 + rng() % 8;
+			for (size_t i = frame + 1; i < inputs.size() && i <= frame + length; ++i)
+			{
+				inputs[i] = inputs[frame];
+			}
+		}
+		break;
+	}
+}
+
+static void WriteCrash(std::string const& directory, TestCase const& test, Trap trap, uint16_t address)
+{
+	char name[64];
+	std::snprintf(name, sizeof(name), "/crash-%d-%.3X", static_cast<int>(trap), address);
+
+	std::ofstream rom(directory + name + ".ch8", std::ios::binary);
+	rom.write(reinterpret_cast<char const*>(test.rom.data()), test.rom.size());
+
+	std::ofstream keys(directory + name + ".keys", std::ios::binary);
+	keys.write(reinterpret_cast<char const*>(test.inputs.data()), test.inputs.size() * sizeof(uint16_t));
+}
+
+int main(int argc, char** argv)
+{
+	char const* romFilename = nullptr;
+	char const* crashDirectory = ".";
+	bool mutateInputs = false;
+	unsigned long iterations = 1000000;
+	unsigned int frames = FUZZ_FRAMES;
+	unsigned int cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+	unsigned int seed = 1;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--mutate") == 0 && i + 1 < argc)
+		{
+			mutateInputs = std::strcmp(argv[++i], "input") == 0;
+		}
+		else if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+		{
+			iterations = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			frames = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--cycles-per-frame") == 0 && i + 1 < argc)
+		{
+			cyclesPerFrame = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--crashes") == 0 && i + 1 < argc)
+		{
+			crashDirectory = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (romFilename == nullptr && argv[i][0] != '-')
+		{
+			romFilename = argv[i];
+		}
+		else
+		{
+			romFilename = nullptr;
+			break;
+		}
+	}
+
+	if (romFilename == nullptr || frames == 0)
+	{
+		std::cerr << "Usage: " << argv[0] << " [--mutate rom|input] [--iterations <n>] [--frames <n>]"
+			<< " [--cycles-per-frame <n>] [--crashes <dir>] [--seed <n>] <seed ROM>\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	std::ifstream file(romFilename, std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cerr << "Cannot load " << romFilename << "\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	TestCase initial;
+	initial.rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	initial.inputs.assign(frames, 0);
+
+	// Every execution starts from this snapshot rather than from init().
+	// Mutated ROMs keep the seed's size, so writing them over the
+	// post-load image replaces the whole ROM.
+	Chip8 chip8;
+	chip8.Seed(seed);
+	chip8.LoadROM(initial.rom.data(), initial.rom.size());
+	Chip8State snapshot;
+	chip8.SaveState(snapshot);
+
+	std::mt19937 rng(seed);
+	Coverage coverage;
+	std::vector<TestCase> corpus(1, initial);
+	std::set<std::pair<int, uint16_t>> crashes;
+
+	Execute(chip8, snapshot, initial, cyclesPerFrame, coverage);
+
+	auto start = std::chrono::steady_clock::now();
+	auto nextReport = start + std::chrono::seconds(1);
+	TestCase test;
+
+	for (unsigned long iteration = 1; iteration <= iterations; ++iteration)
+	{
+		test = corpus[rng() % corpus.size()];
+
+		unsigned int mutations = 1 + rng() % 4;
+		for (unsigned int i = 0; i < mutations; ++i)
+		{
+			if (mutateInputs)
+			{
+				MutateInputs(test.inputs, rng);
+			}
+			else
+			{
+				MutateROM(test.rom, rng);
+			}
+		}
+
+		if (Execute(chip8, snapshot, test, cyclesPerFrame, coverage))
+		{
+			corpus.push_back(test);
+		}
+
+		Trap trap = chip8.GetTrap();
+		if (trap != Trap::None && crashes.insert(std::make_pair(static_cast<int>(trap), chip8.GetTrapAddress())).second)
+		{
+			WriteCrash(crashDirectory, test, trap, chip8.GetTrapAddress());
+		}
+
+		if ((iteration & 0x3FFu) == 0 && std::chrono::steady_clock::now() >= nextReport)
+		{
+			double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			std::printf("#%lu exec/s: %.0f corpus: %zu pcs: %u edges: %u crashes: %zu\n",
+				iteration, iteration / elapsed, corpus.size(), coverage.pcCount, coverage.edgeCount, crashes.size());
+			nextReport += std::chrono::seconds(1);
+		}
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("Done: %lu executions in %.1fs (%.0f exec/s), corpus: %zu pcs: %u edges: %u crashes: %zu\n",
+		iterations, elapsed, iterations / elapsed, corpus.size(), coverage.pcCount, coverage.edgeCount, crashes.size());
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,86 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "workload.hpp"
+
+static void PrintExpected(WorkloadRom const& rom)
+{
+	std::printf("halt %.3X after %llu instructions\n", rom.haltAddress,
+		static_cast<unsigned long long>(rom.instructions));
+	for (unsigned int i = 0; i < REGISTER_COUNT; ++i)
+	{
+		std::printf("V%X=%.2X%s", i, rom.registers[i], i + 1 < REGISTER_COUNT ? " " : "\n");
+	}
+	std::printf("I=%.3X lit=%u\n", rom.index, rom.litPixels);
+	for (auto const& byte : rom.memory)
+	{
+		std::printf("[%.3X]=%.2X\n", byte.first, byte.second);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	WorkloadOptions options;
+	Workload workload = Workload::Count;
+	char const* romFilename = nullptr;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+		{
+			options.iterations = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+		{
+			options.size = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--loop") == 0)
+		{
+			options.loop = true;
+		}
+		else if (workload == Workload::Count && argv[i][0] != '-')
+		{
+			if (!ParseWorkload(argv[i], workload))
+			{
+				std::cerr << "Unknown workload " << argv[i] << ", expected sprites, calls, blockmove, selfmodify or skips\n";
+				return EXIT_FAILURE;
+			}
+		}
+		else if (romFilename == nullptr && argv[i][0] != '-')
+		{
+			romFilename = argv[i];
+		}
+		else
+		{
+			romFilename = nullptr;
+			break;
+		}
+	}
+
+	if (romFilename == nullptr)
+	{
+		std::cerr << "Usage: " << argv[0] << " [--iterations <n>] [--size <n>] [--loop] <workload> <ROM>\n"
+			<< "Workloads: sprites, calls, blockmove, selfmodify, skips\n";
+		return EXIT_FAILURE;
+	}
+
+	WorkloadRom rom;
+	if (!GenerateWorkload(workload, options, rom))
+	{
+		std::cerr << "Iterations or size out of range for " << WorkloadName(workload) << "\n";
+		return EXIT_FAILURE;
+	}
+
+	FILE* file = std::fopen(romFilename, "wb");
+	bool written = file != nullptr && std::fwrite(rom.data.data(), 1, rom.data.size(), file) == rom.data.size();
+	written = file != nullptr && std::fclose(file) == 0 && written;
+	if (!written)
+	{
+		std::cerr << "Cannot write " << romFilename << "\n";
+		return EXIT_FAILURE;
+	}
+
+	PrintExpected(rom);
+	return 0;
+}
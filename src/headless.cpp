@@ -0,0 +1,363 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "beeper.hpp"
+#include "chip8.hpp"
+#include "debugger.hpp"
+#include "romdb.hpp"
+#include "rompack.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
+
+// Runs a ROM without any window or audio device, for batch jobs
+int main(int argc, char** argv)
+{
+	char const* romFilename = nullptr;
+	char const* wavFilename = nullptr;
+	unsigned long frames = 600;
+	unsigned int cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+	bool cyclesGiven = false;
+	char const* romdbFilename = nullptr;
+	char const* packFilename = nullptr;
+	QuirkProfile profile = DEFAULT_QUIRK_PROFILE;
+	bool profileGiven = false;
+	char const* traceFilename = nullptr;
+	bool traceCompressed = false;
+	Debugger debugger;
+	bool debug = false;
+	bool printHash = false;
+	bool stopOnCycle = false;
+	char const* movieFilename = nullptr;
+	bool seedGiven = false;
+	unsigned int cycleBudget = 0;
+	bool printStats = false;
+	bool fusion = true;
+	uint64_t seed = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			frames = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--cycles-per-frame") == 0 && i + 1 < argc)
+		{
+			cyclesPerFrame = std::strtoul(argv[++i], nullptr, 10);
+			cyclesGiven = true;
+		}
+		else if (std::strcmp(argv[i], "--wav") == 0 && i + 1 < argc)
+		{
+			wavFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+		{
+			if (!ParseQuirkProfile(argv[++i], profile))
+			{
+				std::cerr << "Unknown profile " << argv[i] << ", expected vip, chip48, schip or modern\n";
+				std::exit(EXIT_FAILURE);
+			}
+			profileGiven = true;
+		}
+		else if (std::strcmp(argv[i], "--romdb") == 0 && i + 1 < argc)
+		{
+			romdbFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+		{
+			packFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--stop-on-cycle") == 0)
+		{
+			stopOnCycle = true;
+		}
+		else if (std::strcmp(argv[i], "--print-hash") == 0)
+		{
+			printHash = true;
+		}
+		else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+			traceFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--trace-gzip") == 0)
+		{
+			traceCompressed = true;
+		}
+		else if (std::strcmp(argv[i], "--debug") == 0)
+		{
+			debug = true;
+		}
+		else if (std::strcmp(argv[i], "--break") == 0 && i + 1 < argc)
+		{
+			debugger.AddBreakpoint(std::strtoul(argv[++i], nullptr, 16));
+		}
+		else if (std::strcmp(argv[i], "--vip-timing") == 0)
+		{
+			cycleBudget = VIP_CYCLE_BUDGET;
+		}
+		else if (std::strcmp(argv[i], "--cycle-budget") == 0 && i + 1 < argc)
+		{
+			cycleBudget = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--no-fusion") == 0)
+		{
+			fusion = false;
+		}
+		else if (std::strcmp(argv[i], "--stats") == 0)
+		{
+			printStats = true;
+		}
+		else if (std::strcmp(argv[i], "--movie") == 0 && i + 1 < argc)
+		{
+			movieFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = std::strtoull(argv[++i], nullptr, 10);
+			seedGiven = true;
+		}
+		else if (romFilename == nullptr && argv[i][0] != '-')
+		{
+			romFilename = argv[i];
+		}
+		else
+		{
+			romFilename = nullptr;
+			break;
+		}
+	}
+
+	if (romFilename == nullptr)
+	{
+		std::cerr << "Usage: " << argv[0]
+			<< " [--frames <n>] [--cycles-per-frame <n>] [--vip-timing] [--cycle-budget <n>] [--stats] [--no-fusion]"
+			<< " [--stop-on-cycle] [--wav <file>]"
+			<< " [--profile <name>] [--romdb <file>] [--pack <file>]"
+			<< " [--trace <file> [--trace-gzip]]"
+			<< " [--debug] [--break <addr>] [--movie <file>] [--seed <n>] [--print-hash] <ROM>\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	// With a pack, the ROM argument names an entry in it, or gives its hash
+	RomPack pack;
+	RomPackEntry const* packEntry = nullptr;
+	if (packFilename != nullptr)
+	{
+		if (!pack.Open(packFilename))
+		{
+			std::cerr << "Cannot load " << packFilename << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+
+		packEntry = pack.FindName(romFilename);
+		char* end = nullptr;
+		uint64_t hash = std::strtoull(romFilename, &end, 16);
+		if (packEntry == nullptr && *end == '\0')
+		{
+			packEntry = pack.FindHash(hash);
+		}
+		if (packEntry == nullptr)
+		{
+			std::cerr << romFilename << " is not in " << packFilename << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+	}
+
+	// Print the key used by the ROM database
+	if (printHash)
+	{
+		uint64_t hash = packEntry != nullptr ? packEntry->hash : 0;
+		if (packEntry == nullptr && !RomHashFile(romFilename, hash))
+		{
+			std::cerr << "Cannot load " << romFilename << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+		std::printf("%016llx\n", static_cast<unsigned long long>(hash));
+		return 0;
+	}
+
+	// Settings given on the command line win over the pack or the ROM database
+	if (packEntry != nullptr)
+	{
+		if (!profileGiven)
+		{
+			profile = pack.Profile(*packEntry);
+		}
+		if (!cyclesGiven && packEntry->instructionsPerFrame != 0)
+		{
+			cyclesPerFrame = packEntry->instructionsPerFrame;
+		}
+	}
+	else if (romdbFilename != nullptr)
+	{
+		RomDatabase romdb;
+		if (!romdb.Load(romdbFilename))
+		{
+			std::cerr << "Cannot load " << romdbFilename << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+
+		uint64_t hash = 0;
+		RomInfo const* info = RomHashFile(romFilename, hash) ? romdb.Find(hash) : nullptr;
+		if (info != nullptr && !profileGiven)
+		{
+			profile = info->profile;
+		}
+		if (info != nullptr && !cyclesGiven && info->instructionsPerFrame != 0)
+		{
+			cyclesPerFrame = info->instructionsPerFrame;
+		}
+	}
+
+	// Key bitmasks held during each frame, one hex mask per line
+	std::vector<uint16_t> movie;
+	if (movieFilename != nullptr)
+	{
+		std::ifstream file(movieFilename);
+		if (!file.is_open())
+		{
+			std::cerr << "Cannot load " << movieFilename << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+		for (unsigned int keys; file >> std::hex >> keys; )
+		{
+			movie.push_back(keys);
+		}
+	}
+
+	Chip8 chip8 = Chip8();
+	chip8.SetQuirkProfile(profile);
+	chip8.SetFusion(fusion);
+	if (seedGiven)
+	{
+		chip8.Seed(seed);
+	}
+
+	std::unique_ptr<TraceSink> trace;
+	if (traceFilename != nullptr)
+	{
+		trace.reset(new TraceSink(traceFilename, traceCompressed));
+		if (!trace->IsOpen())
+		{
+			std::cerr << "Cannot open " << traceFilename << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+		chip8.SetTraceSink(trace.get());
+	}
+	if (packEntry != nullptr ? !chip8.LoadROM(pack, *packEntry) : !chip8.LoadROM(romFilename))
+	{
+		std::cerr << "Cannot load " << romFilename << "\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	std::unique_ptr<WavWriter> wav;
+	if (wavFilename != nullptr)
+	{
+		wav.reset(new WavWriter(wavFilename, AUDIO_SAMPLE_RATE));
+		if (!wav->IsOpen())
+		{
+			std::cerr << "Cannot open " << wavFilename << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+	}
+
+	Beeper beeper(AUDIO_SAMPLE_RATE, BEEP_FREQUENCY);
+	int16_t samples[AUDIO_SAMPLE_RATE / TIMER_FREQUENCY];
+
+	FrameScheduler scheduler(cyclesPerFrame, cycleBudget, printStats);
+	int exitCode = 0;
+
+	std::unordered_map<uint64_t, unsigned long> history;
+	Chip8State candidate;
+	bool confirming = false;
+	unsigned long confirmFrame = 0;
+	unsigned long period = 0;
+
+	if (debug && !debugger.Prompt(chip8, StopReason::None))
+	{
+		return exitCode;
+	}
+
+	for (unsigned long frame = 0; frame < frames; ++frame)
+	{
+		if (frame < movie.size())
+		{
+			for (unsigned int key = 0; key < KEY_COUNT; ++key)
+			{
+				chip8.keyPad[key] = (movie[frame] >> key) & 1u;
+			}
+		}
+		else if (frame == movie.size() && frame > 0)
+		{
+			std::fill(chip8.keyPad, chip8.keyPad + KEY_COUNT, 0);
+		}
+
+		// Only pay for debug checks while some are set
+		if (debugger.HasChecks())
+		{
+			StopReason reason = debugger.RunFrame(chip8, scheduler);
+			if (reason != StopReason::None && !debugger.Prompt(chip8, reason))
+			{
+				break;
+			}
+		}
+		else
+		{
+			scheduler.RunFrame(chip8);
+		}
+
+		if (chip8.GetTrap() != Trap::None)
+		{
+			std::fprintf(stderr, "\nTrap: %s at %.3X\n", TrapName(chip8.GetTrap()), chip8.GetTrapAddress());
+			exitCode = 3;
+			break;
+		}
+
+		if (wav)
+		{
+			beeper.Trigger(chip8.GetSoundTimer());
+			beeper.Generate(samples, AUDIO_SAMPLE_RATE / TIMER_FREQUENCY);
+			wav->Write(samples, AUDIO_SAMPLE_RATE / TIMER_FREQUENCY);
+		}
+
+		// Once the movie is over nothing changes the keys, so a state seen
+		// at an earlier frame means the run now loops forever. A hash hit
+		// is confirmed by running one more period and comparing the states exactly.
+		if (stopOnCycle && frame >= movie.size())
+		{
+			if (confirming && frame == confirmFrame)
+			{
+				if (chip8.Matches(candidate))
+				{
+					std::printf("State repeats every %lu frames from frame %lu, stopping at frame %lu\n",
+						period, frame + 1 - 2 * period, frame + 1);
+					break;
+				}
+				confirming = false;
+			}
+
+			uint64_t hash = chip8.Hash();
+			auto seen = history.find(hash);
+			if (seen != history.end() && !confirming)
+			{
+				period = frame - seen->second;
+				chip8.SaveState(candidate);
+				confirmFrame = frame + period;
+				confirming = true;
+			}
+			history[hash] = frame;
+		}
+	}
+
+	if (printStats)
+	{
+		PrintStats(scheduler);
+	}
+
+	return exitCode;
+}
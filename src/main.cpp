@@ -1,14 +1,76 @@
+#include <algorithm>
 #include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <thread>
+#include <vector>
+#include "audio.hpp"
 #include "chip8.hpp"
+#include "debugger.hpp"
 #include "display.hpp"
+#include "metrics.hpp"
+#include "romdb.hpp"
+#include "rompack.hpp"
+#include "timeline.hpp"
+#include "timing.hpp"
+#include "trace.hpp"
+#include "wall.hpp"
 #include <SDL2/SDL.h>
 
 const unsigned int WINDOW_WIDTH = 1024;
 const unsigned int WINDOW_HEIGHT = 512;
 
-bool ProcessKeys(uint8_t* keys)
+// Host key for each CHIP-8 key when the ROM does not choose its own
+const char DEFAULT_KEY_MAP[KEY_COUNT + 1] = "x123qweasdzc4rfv";
+
+// Translates a host key that the ROM's key map assigns to a CHIP-8 key
+// into the default host key for that CHIP-8 key
+static SDL_Keycode RemapKey(SDL_Keycode sym, char const* keyMap)
+{
+	for (unsigned int key = 0; key < KEY_COUNT; ++key)
+	{
+		if (keyMap[key] != '\0' && sym == keyMap[key])
+		{
+			return DEFAULT_KEY_MAP[key];
+		}
+	}
+	return sym;
+}
+
+// Set by SIGUSR1 to ask for the timeline to be written
+static volatile std::sig_atomic_t timelineRequested = 0;
+
+static void RequestTimeline(int)
+{
+	timelineRequested = 1;
+}
+
+// Parses "<from>:<to>" in seconds into nanoseconds
+static bool ParseWindow(char const* text, uint64_t& from, uint64_t& to)
+{
+	char* end = nullptr;
+	double fromSeconds = std::strtod(text, &end);
+	if (end == text || *end != ':')
+	{
+		return false;
+	}
+	char const* toText = end + 1;
+	double toSeconds = std::strtod(toText, &end);
+	if (end == toText || *end != '\0' || fromSeconds < 0 || toSeconds <= fromSeconds)
+	{
+		return false;
+	}
+	from = static_cast<uint64_t>(fromSeconds * 1e9);
+	to = static_cast<uint64_t>(toSeconds * 1e9);
+	return true;
+}
+
+bool ProcessKeys(uint8_t* keys, char const* keyMap, bool& breakKeyPressed, bool& showOverlay, bool& fastForward,
+	bool& nextSession, int& clickX, int& clickY)
 {
 	bool quitKeyPressed = false;
 
@@ -24,9 +86,16 @@ bool ProcessKeys(uint8_t* keys)
 			} 
 			break;
 
+			case SDL_MOUSEBUTTONDOWN:
+			{
+				clickX = event.button.x;
+				clickY = event.button.y;
+			} 
+			break;
+
 			case SDL_KEYDOWN:
 			{
-				switch (event.key.keysym.sym)
+				switch (RemapKey(event.key.keysym.sym, keyMap))
 				{
 					case SDLK_ESCAPE:
 					{
@@ -34,6 +103,30 @@ bool ProcessKeys(uint8_t* keys)
 					} 
 					break;
 
+					case SDLK_F1:
+					{
+						breakKeyPressed = true;
+					} 
+					break;
+
+					case SDLK_F2:
+					{
+						showOverlay = !showOverlay;
+					} 
+					break;
+
+					case SDLK_F3:
+					{
+						nextSession = true;
+					} 
+					break;
+
+					case SDLK_TAB:
+					{
+						fastForward = true;
+					} 
+					break;
+
 					case SDLK_x:
 					{
 						keys[0] = 1;
@@ -135,8 +228,14 @@ bool ProcessKeys(uint8_t* keys)
 
 			case SDL_KEYUP:
 			{
-				switch (event.key.keysym.sym)
+				switch (RemapKey(event.key.keysym.sym, keyMap))
 				{
+					case SDLK_TAB:
+					{
+						fastForward = false;
+					} 
+					break;
+
 					case SDLK_x:
 					{
 						keys[0] = 0;
@@ -240,35 +339,568 @@ bool ProcessKeys(uint8_t* keys)
 	return quitKeyPressed;
 }
 
+// Where ROM settings come from, and a profile given on the command line,
+// which wins over both
+struct RomSources
+{
+	RomPack const* pack;
+	RomDatabase const* romdb;
+	QuirkProfile profile;
+	bool profileGiven;
+};
+
+// Load a ROM with its profile, instructions per frame and key map, or exit
+static void LoadRom(Chip8& chip8, char const* romFilename, RomSources const& sources,
+	unsigned int& instructionsPerFrame, char* keyMap)
+{
+	QuirkProfile profile = sources.profile;
+	RomPackEntry const* packEntry = nullptr;
+	if (sources.pack != nullptr)
+	{
+		packEntry = sources.pack->FindName(romFilename);
+		if (packEntry == nullptr)
+		{
+			std::cerr << romFilename << " is not in the pack\n";
+			std::exit(EXIT_FAILURE);
+		}
+
+		if (!sources.profileGiven)
+		{
+			profile = sources.pack->Profile(*packEntry);
+		}
+		if (packEntry->instructionsPerFrame != 0)
+		{
+			instructionsPerFrame = packEntry->instructionsPerFrame;
+		}
+		std::memcpy(keyMap, packEntry->keyMap, KEY_COUNT);
+	}
+	else if (sources.romdb != nullptr)
+	{
+		uint64_t hash = 0;
+		RomInfo const* info = RomHashFile(romFilename, hash) ? sources.romdb->Find(hash) : nullptr;
+		if (info != nullptr)
+		{
+			if (!sources.profileGiven)
+			{
+				profile = info->profile;
+			}
+			if (info->instructionsPerFrame != 0)
+			{
+				instructionsPerFrame = info->instructionsPerFrame;
+			}
+			std::memcpy(keyMap, info->keyMap, KEY_COUNT);
+		}
+	}
+
+	chip8.SetQuirkProfile(profile);
+	if (packEntry != nullptr ? !chip8.LoadROM(*sources.pack, *packEntry) : !chip8.LoadROM(romFilename))
+	{
+		std::cerr << "Cannot load " << romFilename << "\n";
+		std::exit(EXIT_FAILURE);
+	}
+}
+
+// Runs many sessions in one window, on a thread pool, with one texture
+// upload and one present per frame. ROMs are dealt out to the sessions in
+// turn. The keypad and the beeper belong to the session picked with a
+// click or F3.
+static int RunWall(std::vector<char const*> const& romFilenames, unsigned int sessions, unsigned int threads,
+	RomSources const& sources, unsigned int cycleBudget, BeeperMailbox& beeperMailbox, unsigned int audioBuffer)
+{
+	SessionWall wall(sessions, threads);
+	std::vector<char> keyMaps(sessions * KEY_COUNT);
+	for (unsigned int session = 0; session < sessions; ++session)
+	{
+		unsigned int instructionsPerFrame = DEFAULT_CYCLES_PER_FRAME;
+		LoadRom(wall.Session(session), romFilenames[session % romFilenames.size()], sources, instructionsPerFrame,
+			&keyMaps[session * KEY_COUNT]);
+		wall.SetTiming(session, instructionsPerFrame, cycleBudget);
+	}
+
+	// Scale the atlas by a whole factor to about the width of one session's window
+	unsigned int scale = std::max(1u, WINDOW_WIDTH / wall.AtlasWidth());
+	Display display("CHIP-8 Wall", wall.AtlasWidth() * scale, wall.AtlasHeight() * scale, wall.AtlasWidth(),
+		wall.AtlasHeight());
+	Audio audio(beeperMailbox, audioBuffer);
+
+	unsigned int focus = 0;
+	display.SetHighlight(wall.TileX(focus), wall.TileY(focus), DISPLAY_WIDTH, DISPLAY_HEIGHT);
+	std::vector<bool> trapReported(sessions);
+
+	auto const frameDuration = std::chrono::microseconds(1000000 / TIMER_FREQUENCY);
+	auto nextFrame = std::chrono::steady_clock::now();
+	bool quitKeyPressed = false;
+	bool fastForward = false;
+
+	while (!quitKeyPressed)
+	{
+		// The debugger and overlay are for single sessions
+		bool breakKeyPressed = false;
+		bool showOverlay = false;
+		bool nextSession = false;
+		int clickX = -1;
+		int clickY = -1;
+		quitKeyPressed = ProcessKeys(wall.Session(focus).keyPad, &keyMaps[focus * KEY_COUNT], breakKeyPressed,
+			showOverlay, fastForward, nextSession, clickX, clickY);
+
+		int clicked = clickX >= 0 ? wall.SessionAt(clickX / scale, clickY / scale) : -1;
+		unsigned int newFocus = clicked >= 0 ? clicked : nextSession ? (focus + 1) % sessions : focus;
+		if (newFocus != focus)
+		{
+			// Keys held in the old session would otherwise stay down
+			std::memset(wall.Session(focus).keyPad, 0, KEY_COUNT);
+			focus = newFocus;
+			display.SetHighlight(wall.TileX(focus), wall.TileY(focus), DISPLAY_WIDTH, DISPLAY_HEIGHT);
+		}
+
+		// Holding Tab runs wall frames until this host frame is used up
+		auto frameStart = std::chrono::steady_clock::now();
+		unsigned int firstRow = wall.AtlasHeight();
+		unsigned int endRow = 0;
+		do
+		{
+			unsigned int frameFirstRow = 0;
+			unsigned int frameEndRow = 0;
+			wall.RunFrame(frameFirstRow, frameEndRow);
+			if (frameFirstRow < frameEndRow)
+			{
+				firstRow = std::min(firstRow, frameFirstRow);
+				endRow = std::max(endRow, frameEndRow);
+			}
+		}
+		while (fastForward && std::chrono::steady_clock::now() < frameStart + frameDuration);
+		firstRow = std::min(firstRow, endRow);
+
+		for (unsigned int session = 0; session < sessions; ++session)
+		{
+			Chip8 const& chip8 = wall.Session(session);
+			if (chip8.GetTrap() != Trap::None && !trapReported[session])
+			{
+				std::fprintf(stderr, "Session %u trap: %s at %.3X\n", session, TrapName(chip8.GetTrap()),
+					chip8.GetTrapAddress());
+				trapReported[session] = true;
+			}
+		}
+		beeperMailbox.Publish(wall.Session(focus).GetSoundTimer());
+
+		display.Update(wall.Atlas(), wall.AtlasPitch(), firstRow, endRow);
+
+		// As for a single game, pacing starts over once fast-forward stops
+		if (fastForward)
+		{
+			nextFrame = std::chrono::steady_clock::now();
+			continue;
+		}
+		nextFrame += frameDuration;
+		std::this_thread::sleep_until(nextFrame);
+	}
+
+	return 0;
+}
+
 int main(int argc, char** argv)
 {
-	if (argc != 2)
+	std::vector<char const*> romFilenames;
+	unsigned int audioBuffer = DEFAULT_AUDIO_BUFFER;
+	char const* romdbFilename = nullptr;
+	char const* packFilename = nullptr;
+	char const* metricsFilename = nullptr;
+	QuirkProfile profile = DEFAULT_QUIRK_PROFILE;
+	bool profileGiven = false;
+	char const* traceFilename = nullptr;
+	bool traceCompressed = false;
+	Debugger debugger;
+	bool debug = false;
+	unsigned int cycleBudget = 0;
+	bool printStats = false;
+	char const* timelineFilename = nullptr;
+	uint64_t timelineFrom = 0;
+	uint64_t timelineTo = UINT64_MAX;
+	unsigned int speed = 1;
+	unsigned int wallSessions = 0;
+	unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (int i = 1; i < argc; ++i)
 	{
-		std::cerr << "Usage: " << argv[0] << " <ROM>\n";
+		if (std::strcmp(argv[i], "--audio-buffer") == 0 && i + 1 < argc)
+		{
+			audioBuffer = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+		{
+			if (!ParseQuirkProfile(argv[++i], profile))
+			{
+				std::cerr << "Unknown profile " << argv[i] << ", expected vip, chip48, schip or modern\n";
+				std::exit(EXIT_FAILURE);
+			}
+			profileGiven = true;
+		}
+		else if (std::strcmp(argv[i], "--romdb") == 0 && i + 1 < argc)
+		{
+			romdbFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--pack") == 0 && i + 1 < argc)
+		{
+			packFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+			traceFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--trace-gzip") == 0)
+		{
+			traceCompressed = true;
+		}
+		else if (std::strcmp(argv[i], "--vip-timing") == 0)
+		{
+			cycleBudget = VIP_CYCLE_BUDGET;
+		}
+		else if (std::strcmp(argv[i], "--cycle-budget") == 0 && i + 1 < argc)
+		{
+			cycleBudget = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+		{
+			speed = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+		{
+			metricsFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--timeline") == 0 && i + 1 < argc)
+		{
+			timelineFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--timeline-window") == 0 && i + 1 < argc)
+		{
+			if (!ParseWindow(argv[++i], timelineFrom, timelineTo))
+			{
+				std::cerr << "Bad timeline window " << argv[i] << ", expected <from>:<to> in seconds\n";
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		else if (std::strcmp(argv[i], "--stats") == 0)
+		{
+			printStats = true;
+		}
+		else if (std::strcmp(argv[i], "--debug") == 0)
+		{
+			debug = true;
+		}
+		else if (std::strcmp(argv[i], "--break") == 0 && i + 1 < argc)
+		{
+			debugger.AddBreakpoint(std::strtoul(argv[++i], nullptr, 16));
+		}
+		else if (std::strcmp(argv[i], "--wall") == 0 && i + 1 < argc)
+		{
+			wallSessions = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			threads = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (argv[i][0] != '-')
+		{
+			romFilenames.push_back(argv[i]);
+		}
+		else
+		{
+			romFilenames.clear();
+			break;
+		}
+	}
+
+	// Only a wall takes more than one ROM
+	if (romFilenames.empty() || (romFilenames.size() > 1 && wallSessions == 0))
+	{
+		std::cerr << "Usage: " << argv[0]
+			<< " [--audio-buffer <samples>] [--profile <name>] [--romdb <file>] [--pack <file>]"
+			<< " [--vip-timing] [--cycle-budget <n>] [--speed <n>] [--stats] [--metrics <file>]"
+			<< " [--trace <file> [--trace-gzip]] [--timeline <file> [--timeline-window <from>:<to>]]"
+			<< " [--debug] [--break <addr>] <ROM>\n"
+			<< "       " << argv[0] << " --wall <sessions> [--threads <n>] [--profile <name>] [--romdb <file>] [--pack <file>]"
+			<< " [--vip-timing] [--cycle-budget <n>] <ROM>...\n";
 		std::exit(EXIT_FAILURE);
 	}
 
-	char const* romFilename = argv[1];
+	// A wall has no single machine to debug, trace or time
+	if (wallSessions != 0 && (debug || debugger.HasChecks() || traceFilename != nullptr || metricsFilename != nullptr
+		|| timelineFilename != nullptr || printStats || speed != 1))
+	{
+		std::cerr << "--debug, --break, --trace, --metrics, --timeline, --stats and --speed only work with a single game\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	// With a pack, ROM arguments name entries in it
+	RomPack pack;
+	if (packFilename != nullptr && !pack.Open(packFilename))
+	{
+		std::cerr << "Cannot load " << packFilename << "\n";
+		std::exit(EXIT_FAILURE);
+	}
+	RomDatabase romdb;
+	if (packFilename == nullptr && romdbFilename != nullptr && !romdb.Load(romdbFilename))
+	{
+		std::cerr << "Cannot load " << romdbFilename << "\n";
+		std::exit(EXIT_FAILURE);
+	}
+	RomSources sources = { packFilename != nullptr ? &pack : nullptr,
+		packFilename == nullptr && romdbFilename != nullptr ? &romdb : nullptr, profile, profileGiven };
+
+	BeeperMailbox beeperMailbox;
+	if (wallSessions != 0)
+	{
+		return RunWall(romFilenames, wallSessions, threads, sources, cycleBudget, beeperMailbox, audioBuffer);
+	}
+	char const* romFilename = romFilenames[0];
 
 	Display display("CHIP-8 Emulator", WINDOW_WIDTH, WINDOW_HEIGHT, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+	Audio audio(beeperMailbox, audioBuffer);
 
 	Chip8 chip8 = Chip8();
-	chip8.LoadROM(romFilename);
+	std::unique_ptr<TraceSink> trace;
+	if (traceFilename != nullptr)
+	{
+		trace.reset(new TraceSink(traceFilename, traceCompressed));
+		if (!trace->IsOpen())
+		{
+			std::cerr << "Cannot open " << traceFilename << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+		chip8.SetTraceSink(trace.get());
+	}
+
+	unsigned int instructionsPerFrame = DEFAULT_CYCLES_PER_FRAME;
+	char keyMap[KEY_COUNT] = {};
+	LoadRom(chip8, romFilename, sources, instructionsPerFrame, keyMap);
 
 	int videoPitch = sizeof(chip8.display[0]) * DISPLAY_WIDTH;
 
+	auto const frameDuration = std::chrono::microseconds(1000000 / TIMER_FREQUENCY);
+	auto nextFrame = std::chrono::steady_clock::now();
+
+	FrameScheduler scheduler(instructionsPerFrame, cycleBudget, printStats);
 	bool quitKeyPressed = false;
+	int exitCode = 0;
+
+	Metrics metrics;
+	std::unique_ptr<MetricsExporter> exporter;
+	if (metricsFilename != nullptr)
+	{
+		exporter.reset(new MetricsExporter(metrics, metricsFilename, std::chrono::seconds(1)));
+	}
+
+	// Timeline events are recorded inside the window, and written when it
+	// closes, on SIGUSR1 and on exit
+	bool timelineWritten = false;
+	if (timelineFilename != nullptr)
+	{
+		SetTimelineThreadName("main");
+		std::signal(SIGUSR1, RequestTimeline);
+	}
+	auto writeTimeline = [&](uint64_t from, uint64_t to)
+	{
+		if (WriteTimeline(timelineFilename, from, to))
+		{
+			std::fprintf(stderr, "Wrote the timeline to %s\n", timelineFilename);
+		}
+		else
+		{
+			std::fprintf(stderr, "Cannot write %s\n", timelineFilename);
+		}
+	};
+
+	// F2 shows the counters of the last second over the screen
+	bool showOverlay = false;
+	char overlay[64] = "";
+	auto lastOverlay = nextFrame;
+	auto nextOverlay = nextFrame;
+	uint64_t overlayInstructions = 0;
+	uint64_t overlayFrames = 0;
+	uint64_t overlayLateFrames = 0;
+	uint64_t overlayEmulatedFrames = 0;
+
+	// While Tab is held, or with --speed, several emulated frames run for
+	// every host frame and only the newest is presented. Timers still tick
+	// once per emulated frame.
+	bool fastForward = false;
+	char title[64] = "";
+
+	// The debugger prompt blocks for as long as it likes, so pacing starts
+	// over once it returns and the frame it stopped in is not late
+	bool prompted = false;
+	auto prompt = [&](StopReason reason)
+	{
+		if (!debugger.Prompt(chip8, reason))
+		{
+			return false;
+		}
+		nextFrame = std::chrono::steady_clock::now();
+		prompted = true;
+		return true;
+	};
+
+	// Runs one emulated frame, returning false to end the session
+	auto emulateFrame = [&]()
+	{
+		uint64_t instructions = scheduler.Instructions();
+		StopReason reason = StopReason::None;
+		{
+			TIMELINE_SCOPE("emulate");
+			ScopedTimer timer(metrics.emulate);
+			// Only pay for debug checks while some are set
+			if (debugger.HasChecks())
+			{
+				reason = debugger.RunFrame(chip8, scheduler);
+			}
+			else
+			{
+				scheduler.RunFrame(chip8);
+			}
+		}
+		metrics.instructions.fetch_add(scheduler.Instructions() - instructions, std::memory_order_relaxed);
+		metrics.framesEmulated.fetch_add(1, std::memory_order_relaxed);
+
+		// The prompt is outside the timer, so waiting on it is not emulation
+		if (reason != StopReason::None && !prompt(reason))
+		{
+			return false;
+		}
+
+		if (chip8.GetTrap() != Trap::None)
+		{
+			std::fprintf(stderr, "\nTrap: %s at %.3X\n", TrapName(chip8.GetTrap()), chip8.GetTrapAddress());
+			exitCode = 3;
+			return false;
+		}
+		return true;
+	};
 
 	while (!quitKeyPressed)
 	{
-		quitKeyPressed = ProcessKeys(chip8.keyPad);
+		if (timelineFilename != nullptr)
+		{
+			uint64_t now = TimelineNow();
+			SetTimelineActive(now >= timelineFrom && now < timelineTo);
+			if (now >= timelineTo && !timelineWritten)
+			{
+				writeTimeline(timelineFrom, timelineTo);
+				timelineWritten = true;
+			}
+			if (timelineRequested)
+			{
+				timelineRequested = 0;
+				writeTimeline(0, UINT64_MAX);
+			}
+		}
 
-		chip8.EmulateCycle();
+		TIMELINE_SCOPE("frame");
+		auto frameStart = std::chrono::steady_clock::now();
+		bool breakKeyPressed = debug;
+		debug = false;
+		{
+			TIMELINE_SCOPE("poll events");
+			ScopedTimer timer(metrics.processKeys);
+			bool nextSession = false;
+			int clickX = -1;
+			int clickY = -1;
+			quitKeyPressed = ProcessKeys(chip8.keyPad, keyMap, breakKeyPressed, showOverlay, fastForward, nextSession,
+				clickX, clickY);
+		}
 
-		display.Update(chip8.display, videoPitch);
+		// The debugger reads commands on stdin while the window waits
+		prompted = false;
+		if (breakKeyPressed && !prompt(StopReason::None))
+		{
+			break;
+		}
 
-		std::this_thread::sleep_for(std::chrono::microseconds(1200));
+		// A speed of zero runs frames until this host frame is used up
+		unsigned int framesPerPresent = fastForward ? 0 : speed;
+		auto deadline = frameStart + frameDuration;
+		unsigned int framesEmulated = 0;
+		bool running = true;
+		do
+		{
+			running = emulateFrame();
+			++framesEmulated;
+		}
+		while (running && (framesPerPresent == 0 ? std::chrono::steady_clock::now() < deadline : framesEmulated < framesPerPresent));
+		if (!running)
+		{
+			break;
+		}
+		beeperMailbox.Publish(chip8.GetSoundTimer());
+
+		if (frameStart >= nextOverlay)
+		{
+			uint64_t totalInstructions = metrics.instructions.load(std::memory_order_relaxed);
+			uint64_t totalFrames = metrics.framesPresented.load(std::memory_order_relaxed);
+			uint64_t totalLateFrames = metrics.lateFrames.load(std::memory_order_relaxed);
+			uint64_t totalEmulatedFrames = metrics.framesEmulated.load(std::memory_order_relaxed);
+			std::snprintf(overlay, sizeof(overlay), "IPS %llu FPS %llu LATE %llu",
+				static_cast<unsigned long long>(totalInstructions - overlayInstructions),
+				static_cast<unsigned long long>(totalFrames - overlayFrames),
+				static_cast<unsigned long long>(totalLateFrames - overlayLateFrames));
+
+			// The achieved speed, against 60 emulated frames per second
+			std::chrono::duration<double> elapsed = frameStart - lastOverlay;
+			double achieved = (totalEmulatedFrames - overlayEmulatedFrames) / (elapsed.count() * TIMER_FREQUENCY);
+			if ((fastForward || speed != 1) && elapsed.count() > 0)
+			{
+				std::snprintf(title, sizeof(title), "CHIP-8 Emulator %.1fx", achieved);
+			}
+			else
+			{
+				std::snprintf(title, sizeof(title), "CHIP-8 Emulator");
+			}
+			display.SetTitle(title);
+
+			overlayInstructions = totalInstructions;
+			overlayFrames = totalFrames;
+			overlayLateFrames = totalLateFrames;
+			overlayEmulatedFrames = totalEmulatedFrames;
+			lastOverlay = frameStart;
+			nextOverlay = frameStart + std::chrono::seconds(1);
+		}
+
+		{
+			TIMELINE_SCOPE("display");
+			ScopedTimer timer(metrics.displayUpdate);
+			display.Update(chip8.display, videoPitch, chip8.TakeDirtyRows(), showOverlay ? overlay : nullptr);
+		}
+		metrics.framesPresented.fetch_add(1, std::memory_order_relaxed);
+
+		auto frameEnd = std::chrono::steady_clock::now();
+		metrics.frame.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(frameEnd - frameStart).count());
+
+		// Uncapped frames neither sleep nor count as late, and pacing
+		// starts over from here once they stop
+		if (framesPerPresent == 0)
+		{
+			nextFrame = frameEnd;
+			continue;
+		}
+
+		nextFrame += frameDuration;
+		if (frameEnd > nextFrame && !prompted)
+		{
+			metrics.lateFrames.fetch_add(1, std::memory_order_relaxed);
+		}
+		TIMELINE_SCOPE("sleep");
+		std::this_thread::sleep_until(nextFrame);
 	}
 
-	return 0;
-}
+	if (timelineFilename != nullptr && !timelineWritten)
+	{
+		writeTimeline(timelineFrom, timelineTo);
+	}
+
+	if (printStats)
+	{
+		PrintStats(scheduler);
+		PrintSummary(metrics);
+	}
+
+	return exitCode;
+}
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "metrics.hpp"
+#include <cstdio>
+#include <fstream>
+
+unsigned int LatencyHistogram::Bucket(uint64_t value)
+{
+	if (value < SUB_BUCKETS)
+	{
+		return value;
+	}
+
+	unsigned int exponent = 63 - __builtin_clzll(value);
+	unsigned int subBucket = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+	return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + subBucket;
+}
+
+uint64_t LatencyHistogram::BucketLimit(unsigned int bucket)
+{
+	if (bucket < SUB_BUCKETS)
+	{
+		return bucket;
+	}
+
+	unsigned int shift = bucket / SUB_BUCKETS - 1;
+	uint64_t lowest = static_cast<uint64_t>(SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+	return lowest + ((uint64_t(1) << shift) - 1);
+}
+
+uint64_t LatencyHistogram::Percentile(double fraction) const
+{
+	uint64_t total = 0;
+	for (unsigned int bucket = 0; bucket < BUCKET_COUNT; ++bucket)
+	{
+		total += buckets[bucket].load(std::memory_order_relaxed);
+	}
+
+	uint64_t rank = static_cast<uint64_t>(fraction * total + 0.5);
+	uint64_t seen = 0;
+	for (unsigned int bucket = 0; bucket < BUCKET_COUNT; ++bucket)
+	{
+		seen += buckets[bucket].load(std::memory_order_relaxed);
+		if (seen >= rank && seen > 0)
+		{
+			return BucketLimit(bucket);
+		}
+	}
+	return 0;
+}
+
+static double Seconds(Metrics const& metrics)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - metrics.start).count();
+}
+
+static void WriteSummary(std::ofstream& file, char const* name, char const* help, LatencyHistogram const& histogram)
+{
+	double const quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+	file << "# HELP " << name << " " << help << "\n# TYPE " << name << " summary\n";
+	for (double quantile : quantiles)
+	{
+		file << name << "{quantile=\"" << quantile << "\"} " << histogram.Percentile(quantile) * 1e-9 << "\n";
+	}
+	file << name << "_sum " << histogram.Sum() * 1e-9 << "\n";
+	file << name << "_count " << histogram.Count() << "\n";
+}
+
+static void WriteCounter(std::ofstream& file, char const* name, char const* help, uint64_t value)
+{
+	file << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n" << name << " " << value << "\n";
+}
+
+bool WritePrometheus(Metrics const& metrics, std::string const& filename)
+{
+	std::string temporary = filename + ".tmp";
+	{
+		std::ofstream file(temporary);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		double seconds = Seconds(metrics);
+		uint64_t instructions = metrics.instructions.load(std::memory_order_relaxed);
+
+		file << "# HELP chip8_uptime_seconds Time since the session started.\n"
+			<< "# TYPE chip8_uptime_seconds gauge\n"
+			<< "chip8_uptime_seconds " << seconds << "\n";
+		file << "# HELP chip8_instructions_per_second Emulated instructions per second since the start.\n"
+			<< "# TYPE chip8_instructions_per_second gauge\n"
+			<< "chip8_instructions_per_second " << (seconds > 0 ? instructions / seconds : 0) << "\n";
+
+		WriteCounter(file, "chip8_instructions_total", "Emulated instructions.", instructions);
+		WriteCounter(file, "chip8_frames_emulated_total", "Emulated 60 Hz frames.",
+			metrics.framesEmulated.load(std::memory_order_relaxed));
+		WriteCounter(file, "chip8_frames_presented_total", "Frames shown on screen.",
+			metrics.framesPresented.load(std::memory_order_relaxed));
+		WriteCounter(file, "chip8_late_frames_total", "Frames that finished after their deadline.",
+			metrics.lateFrames.load(std::memory_order_relaxed));
+
+		WriteSummary(file, "chip8_process_keys_seconds", "Time spent reading input.", metrics.processKeys);
+		WriteSummary(file, "chip8_emulate_seconds", "Time spent emulating a frame.", metrics.emulate);
+		WriteSummary(file, "chip8_display_update_seconds", "Time spent presenting a frame.", metrics.displayUpdate);
+		WriteSummary(file, "chip8_frame_seconds", "Time spent on a frame, excluding the wait for the next one.",
+			metrics.frame);
+
+		if (!file.good())
+		{
+			return false;
+		}
+	}
+
+	return std::rename(temporary.c_str(), filename.c_str()) == 0;
+}
+
+static void PrintHistogram(char const* name, LatencyHistogram const& histogram)
+{
+	std::printf("  %-16s p50 %8.3fms  p99 %8.3fms  p99.9 %8.3fms  (%llu samples)\n", name,
+		histogram.Percentile(0.5) * 1e-6, histogram.Percentile(0.99) * 1e-6, histogram.Percentile(0.999) * 1e-6,
+		static_cast<unsigned long long>(histogram.Count()));
+}
+
+void PrintSummary(Metrics const& metrics)
+{
+	double seconds = Seconds(metrics);
+	uint64_t instructions = metrics.instructions.load(std::memory_order_relaxed);
+
+	std::printf("Ran %.1fs: %llu instructions (%.0f/s), %llu frames emulated, %llu presented, %llu late\n",
+		seconds, static_cast<unsigned long long>(instructions), seconds > 0 ? instructions / seconds : 0,
+		static_cast<unsigned long long>(metrics.framesEmulated.load(std::memory_order_relaxed)),
+		static_cast<unsigned long long>(metrics.framesPresented.load(std::memory_order_relaxed)),
+		static_cast<unsigned long long>(metrics.lateFrames.load(std::memory_order_relaxed)));
+	PrintHistogram("input", metrics.processKeys);
+	PrintHistogram("emulation", metrics.emulate);
+	PrintHistogram("display", metrics.displayUpdate);
+	PrintHistogram("frame", metrics.frame);
+}
+
+MetricsExporter::MetricsExporter(Metrics const& metrics, std::string const& filename, std::chrono::milliseconds interval)
+	: metrics(metrics), filename(filename), interval(interval)
+{
+	thread = std::thread(&MetricsExporter::Run, this);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	thread.join();
+
+	// Leave the final values behind
+	WritePrometheus(metrics, filename);
+}
+
+void MetricsExporter::Run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!wake.wait_for(lock, interval, [this] { return stopping; }))
+	{
+		WritePrometheus(metrics, filename);
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Log-linear histogram of durations in nanoseconds, in the style of
+// HdrHistogram: 8 buckets per power of two, so a percentile is never more
+// than 12.5% above the true value. Recording is one relaxed atomic add.
+class LatencyHistogram
+{
+public:
+	void Record(uint64_t nanoseconds)
+	{
+		buckets[Bucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+		count.fetch_add(1, std::memory_order_relaxed);
+		sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+	}
+
+	uint64_t Count() const { return count.load(std::memory_order_relaxed); }
+	uint64_t Sum() const { return sum.load(std::memory_order_relaxed); }
+
+	// Upper bound of the bucket holding the given fraction of the values
+	uint64_t Percentile(double fraction) const;
+
+private:
+	static const unsigned int SUB_BUCKET_BITS = 3;
+	static const unsigned int SUB_BUCKETS = 1u << SUB_BUCKET_BITS;
+	static const unsigned int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	static unsigned int Bucket(uint64_t value);
+	static uint64_t BucketLimit(unsigned int bucket);
+
+	std::atomic<uint64_t> buckets[BUCKET_COUNT]{};
+	std::atomic<uint64_t> count{0};
+	std::atomic<uint64_t> sum{0};
+};
+
+// Counters for one emulator session. Everything is relaxed atomics, so
+// another thread can read them while the main loop runs.
+struct Metrics
+{
+	std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+	std::atomic<uint64_t> instructions{0};
+	std::atomic<uint64_t> framesEmulated{0};
+	std::atomic<uint64_t> framesPresented{0};
+	std::atomic<uint64_t> lateFrames{0};
+	LatencyHistogram processKeys;
+	LatencyHistogram emulate;
+	LatencyHistogram displayUpdate;
+	LatencyHistogram frame;
+};
+
+// Records the time from construction to destruction into a histogram
+class ScopedTimer
+{
+public:
+	explicit ScopedTimer(LatencyHistogram& histogram)
+		: histogram(histogram), start(std::chrono::steady_clock::now())
+	{
+	}
+
+	~ScopedTimer()
+	{
+		histogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count());
+	}
+
+private:
+	LatencyHistogram& histogram;
+	std::chrono::steady_clock::time_point start;
+};
+
+// Writes the metrics in the Prometheus text format. The file is written
+// under a temporary name and renamed, so readers never see half of it.
+bool WritePrometheus(Metrics const& metrics, std::string const& filename);
+
+void PrintSummary(Metrics const& metrics);
+
+// Rewrites the Prometheus file from a background thread
+class MetricsExporter
+{
+public:
+	MetricsExporter(Metrics const& metrics, std::string const& filename, std::chrono::milliseconds interval);
+	~MetricsExporter();
+
+private:
+	void Run();
+
+	Metrics const& metrics;
+	std::string filename;
+	std::chrono::milliseconds interval;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping{};
+	std::thread thread;
+};
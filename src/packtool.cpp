@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+#include "romdb.hpp"
+#include "rompack.hpp"
+
+static int Build(char const* packFilename, char const* directory, char const* romdbFilename)
+{
+	RomDatabase romdb;
+	if (romdbFilename != nullptr && !romdb.Load(romdbFilename))
+	{
+		std::cerr << "Cannot load " << romdbFilename << "\n";
+		return EXIT_FAILURE;
+	}
+
+	DIR* dir = opendir(directory);
+	if (dir == nullptr)
+	{
+		std::cerr << "Cannot open " << directory << "\n";
+		return EXIT_FAILURE;
+	}
+
+	std::vector<std::string> names;
+	for (dirent* file = readdir(dir); file != nullptr; file = readdir(dir))
+	{
+		if (file->d_name[0] != '.')
+		{
+			names.push_back(file->d_name);
+		}
+	}
+	closedir(dir);
+	std::sort(names.begin(), names.end());
+
+	std::vector<RomPackInput> roms;
+	for (std::string const& name : names)
+	{
+		std::string path = std::string(directory) + "/" + name;
+		struct stat status;
+		if (stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+		{
+			continue;
+		}
+
+		std::ifstream file(path, std::ios::binary);
+		if (!file.is_open())
+		{
+			continue;
+		}
+
+		RomPackInput rom;
+		rom.name = name;
+		rom.data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+		RomInfo const* info = romdb.Find(RomHash(rom.data.data(), rom.data.size()));
+		if (info != nullptr)
+		{
+			rom.profile = info->profile;
+			rom.instructionsPerFrame = info->instructionsPerFrame;
+			std::memcpy(rom.keyMap, info->keyMap, sizeof(rom.keyMap));
+		}
+		roms.push_back(rom);
+	}
+
+	if (!WriteRomPack(packFilename, roms))
+	{
+		std::cerr << "Cannot write " << packFilename << "\n";
+		return EXIT_FAILURE;
+	}
+
+	std::printf("Packed %zu ROMs into %s\n", roms.size(), packFilename);
+	return 0;
+}
+
+static int List(char const* packFilename)
+{
+	RomPack pack;
+	if (!pack.Open(packFilename))
+	{
+		std::cerr << "Cannot load " << packFilename << "\n";
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < pack.Count(); ++i)
+	{
+		RomPackEntry const& entry = pack.Entry(i);
+		std::printf("%016llx  %-7s  %3u  %5u  %.16s  %s\n", static_cast<unsigned long long>(entry.hash),
+			QuirkProfileName(pack.Profile(entry)), entry.instructionsPerFrame, entry.dataSize,
+			entry.keyMap[0] != '\0' ? entry.keyMap : "-", pack.Name(entry));
+	}
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	if ((argc == 4 || (argc == 6 && std::strcmp(argv[4], "--romdb") == 0)) && std::strcmp(argv[1], "build") == 0)
+	{
+		return Build(argv[2], argv[3], argc == 6 ? argv[5] : nullptr);
+	}
+
+	if (argc == 3 && std::strcmp(argv[1], "list") == 0)
+	{
+		return List(argv[2]);
+	}
+
+	std::cerr << "Usage: " << argv[0] << " build <pack> <directory> [--romdb <file>]\n"
+		<< "       " << argv[0] << " list <pack>\n";
+	return EXIT_FAILURE;
+}
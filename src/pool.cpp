@@ -0,0 +1,134 @@
+#include "pool.hpp"
+#include <memory>
+#include <new>
+
+size_t Chip8Pool::SlotSize()
+{
+	return (sizeof(Chip8) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+}
+
+Chip8Pool::Chip8Pool(unsigned int capacity, PoolMemory memory)
+	: capacity(capacity), memory(memory), romOfSlot(capacity, -1)
+{
+	size_t size = capacity * SlotSize();
+	size_t space = size + CACHE_LINE_SIZE;
+	storage = new unsigned char[space];
+
+	void* aligned = storage;
+	arena = static_cast<unsigned char*>(std::align(CACHE_LINE_SIZE, size, aligned, space));
+
+	// Hand out low slots first. Slots are constructed on first acquire,
+	// so the arena's pages stay untouched until a machine needs them.
+	freeSlots.reserve(capacity);
+	for (unsigned int slot = capacity; slot > 0; --slot)
+	{
+		freeSlots.push_back(slot - 1);
+	}
+}
+
+Chip8Pool::~Chip8Pool()
+{
+	for (unsigned int slot = 0; slot < constructed; ++slot)
+	{
+		reinterpret_cast<Chip8*>(arena + slot * SlotSize())->~Chip8();
+	}
+	delete[] storage;
+}
+
+int Chip8Pool::AddROM(char const* filename, QuirkProfile profile)
+{
+	Chip8 loader;
+	return loader.LoadROM(filename) ? AddGolden(loader, profile) : -1;
+}
+
+int Chip8Pool::AddROM(uint8_t const* data, size_t size, QuirkProfile profile)
+{
+	Chip8 loader;
+	return loader.LoadROM(data, size) ? AddGolden(loader, profile) : -1;
+}
+
+int Chip8Pool::AddGolden(Chip8& loader, QuirkProfile profile)
+{
+	Golden golden;
+	// Machines are reseeded on every reset, but keep the image itself
+	// free of the load time too
+	loader.Seed(0);
+	loader.MarkClean();
+	loader.SaveState(golden.state);
+	golden.profile = profile;
+	goldens.push_back(golden);
+	return goldens.size() - 1;
+}
+
+Chip8* Chip8Pool::Acquire(int rom)
+{
+	if (freeSlots.empty() || rom < 0 || rom >= static_cast<int>(goldens.size()))
+	{
+		return nullptr;
+	}
+
+	unsigned int slot = freeSlots.back();
+	freeSlots.pop_back();
+	romOfSlot[slot] = rom;
+
+	// Released slots are taken first, so a new one is the next unconstructed
+	if (slot == constructed)
+	{
+		if (memory == PoolMemory::Shared)
+		{
+			new (arena + slot * SlotSize()) Chip8(goldens[rom].state);
+		}
+		else
+		{
+			new (arena + slot * SlotSize()) Chip8();
+		}
+		++constructed;
+	}
+
+	Chip8* chip8 = reinterpret_cast<Chip8*>(arena + slot * SlotSize());
+	chip8->SetQuirkProfile(goldens[rom].profile);
+	ResetFull(chip8);
+	return chip8;
+}
+
+void Chip8Pool::Release(Chip8* chip8)
+{
+	unsigned int slot = SlotOf(chip8);
+	romOfSlot[slot] = -1;
+	freeSlots.push_back(slot);
+}
+
+void Chip8Pool::Reset(Chip8* chip8)
+{
+	unsigned int slot = SlotOf(chip8);
+	Chip8State const& golden = goldens[romOfSlot[slot]].state;
+	if (memory == PoolMemory::Shared)
+	{
+		chip8->LoadShared(golden);
+	}
+	else
+	{
+		chip8->RestoreDirty(golden);
+	}
+	chip8->Seed(slot);
+}
+
+void Chip8Pool::ResetFull(Chip8* chip8)
+{
+	unsigned int slot = SlotOf(chip8);
+	Chip8State const& golden = goldens[romOfSlot[slot]].state;
+	if (memory == PoolMemory::Shared)
+	{
+		chip8->LoadShared(golden);
+	}
+	else
+	{
+		chip8->LoadState(golden);
+	}
+	chip8->Seed(slot);
+}
+
+unsigned int Chip8Pool::SlotOf(Chip8 const* chip8) const
+{
+	return (reinterpret_cast<unsigned char const*>(chip8) - arena) / SlotSize();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "chip8.hpp"
+
+const size_t CACHE_LINE_SIZE = 64;
+
+// Where pool machines read the ROM's memory from
+enum class PoolMemory
+{
+	Private, // Each machine holds its own copy
+	Shared   // Machines read the golden image in place and copy a page on its first write
+};
+
+// Fixed-size pool of machines reset from per-ROM golden images.
+// Machines live in one cache-aligned arena, each in a slot rounded up
+// to a whole number of cache lines. A slot holds everything but memory:
+// private machines add MEMORY_SIZE bytes of their own, shared machines
+// only the pages they wrote. Slots never acquired are never touched.
+class Chip8Pool
+{
+public:
+	explicit Chip8Pool(unsigned int capacity, PoolMemory memory = PoolMemory::Private);
+	~Chip8Pool();
+	Chip8Pool(Chip8Pool const&) = delete;
+	Chip8Pool& operator=(Chip8Pool const&) = delete;
+
+	// Load a ROM once and keep its post-load state. Returns the ROM id
+	// to acquire machines with, or -1 if the ROM cannot be loaded.
+	int AddROM(char const* filename, QuirkProfile profile = DEFAULT_QUIRK_PROFILE);
+	int AddROM(uint8_t const* data, size_t size, QuirkProfile profile = DEFAULT_QUIRK_PROFILE);
+
+	// A machine in the golden state of the ROM, or nullptr if the pool is full
+	Chip8* Acquire(int rom);
+	void Release(Chip8* chip8);
+
+	// Every reset seeds the random number generator from the machine's
+	// slot, so a run repeats exactly and slots draw different numbers.
+
+	// Copy back only the memory pages written since the last reset. With
+	// shared memory, no page is copied: written pages go back to sharing.
+	void Reset(Chip8* chip8);
+	// Copy back the whole golden image
+	void ResetFull(Chip8* chip8);
+
+	unsigned int Capacity() const { return capacity; }
+	unsigned int InUse() const { return capacity - freeSlots.size(); }
+	static size_t SlotSize();
+
+private:
+	int AddGolden(Chip8& loader, QuirkProfile profile);
+	unsigned int SlotOf(Chip8 const* chip8) const;
+
+	struct Golden
+	{
+		Chip8State state;
+		QuirkProfile profile;
+	};
+
+	unsigned int capacity;
+	PoolMemory memory;
+	unsigned char* storage;
+	unsigned char* arena;
+	// Slots below this hold a machine
+	unsigned int constructed{};
+	// Shared machines point into the golden images, so they must not move
+	std::deque<Golden> goldens;
+	std::vector<int> romOfSlot;
+	std::vector<unsigned int> freeSlots;
+};
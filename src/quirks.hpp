@@ -0,0 +1,67 @@
+#pragma once
+
+// Behaviors that differ between CHIP-8 implementations
+enum class QuirkProfile
+{
+	CosmacVip,
+	Chip48,
+	SuperChip,
+	Modern
+};
+
+const QuirkProfile DEFAULT_QUIRK_PROFILE = QuirkProfile::SuperChip;
+
+bool ParseQuirkProfile(char const* name, QuirkProfile& profile);
+char const* QuirkProfileName(QuirkProfile profile);
+
+// How FX55/FX65 leave I after the transfer
+enum class IndexIncrement
+{
+	None,
+	ByX,
+	ByXPlusOne
+};
+
+// Each profile is a set of compile-time constants. The core is
+// instantiated once per profile, so handlers never test a quirk at run time.
+//
+// resetFlag:      8XY1/8XY2/8XY3 set VF to 0
+// indexIncrement: FX55/FX65 advance I
+// shiftUsesVy:    8XY6/8XYE shift VY into VX rather than shifting VX
+// jumpUsesVx:     BXNN jumps to XNN + VX rather than NNN + V0
+// wrapSprites:    DXYN wraps pixels around the edges rather than clipping
+struct CosmacVipQuirks
+{
+	static const bool resetFlag = true;
+	static const IndexIncrement indexIncrement = IndexIncrement::ByXPlusOne;
+	static const bool shiftUsesVy = true;
+	static const bool jumpUsesVx = false;
+	static const bool wrapSprites = false;
+};
+
+struct Chip48Quirks
+{
+	static const bool resetFlag = false;
+	static const IndexIncrement indexIncrement = IndexIncrement::ByX;
+	static const bool shiftUsesVy = false;
+	static const bool jumpUsesVx = true;
+	static const bool wrapSprites = false;
+};
+
+struct SuperChipQuirks
+{
+	static const bool resetFlag = false;
+	static const IndexIncrement indexIncrement = IndexIncrement::None;
+	static const bool shiftUsesVy = false;
+	static const bool jumpUsesVx = true;
+	static const bool wrapSprites = false;
+};
+
+struct ModernQuirks
+{
+	static const bool resetFlag = false;
+	static const IndexIncrement indexIncrement = IndexIncrement::ByXPlusOne;
+	static const bool shiftUsesVy = true;
+	static const bool jumpUsesVx = false;
+	static const bool wrapSprites = true;
+};
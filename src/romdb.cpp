@@ -0,0 +1,106 @@
+#include "romdb.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+uint64_t RomHash(uint8_t const* data, size_t size)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= data[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+bool RomHashFile(char const* filename, uint64_t& hash)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	hash = RomHash(data.data(), data.size());
+	return true;
+}
+
+bool RomDatabase::Load(char const* filename)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::string line;
+	unsigned int lineNumber = 0;
+
+	while (std::getline(file, line))
+	{
+		++lineNumber;
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		std::istringstream fields(line);
+		std::string hash;
+		std::string profile;
+		RomInfo info;
+
+		fields >> hash >> profile >> std::ws;
+
+		// Optional settings come before the name
+		std::string setting;
+		while (fields.peek() == 'i' || fields.peek() == 'k')
+		{
+			std::streampos start = fields.tellg();
+			fields >> setting >> std::ws;
+
+			if (setting.compare(0, 4, "ipf=") == 0)
+			{
+				info.instructionsPerFrame = std::strtoul(setting.c_str() + 4, nullptr, 10);
+			}
+			else if (setting.compare(0, 5, "keys=") == 0 && setting.size() == 5 + sizeof(info.keyMap))
+			{
+				setting.copy(info.keyMap, sizeof(info.keyMap), 5);
+			}
+			else
+			{
+				fields.seekg(start);
+				break;
+			}
+		}
+		std::getline(fields, info.name);
+
+		if (!ParseQuirkProfile(profile.c_str(), info.profile))
+		{
+			std::cerr << filename << ":" << lineNumber << ": unknown profile '" << profile << "'\n";
+			continue;
+		}
+
+		char* end = nullptr;
+		info.hash = std::strtoull(hash.c_str(), &end, 16);
+		if (hash.empty() || *end != '\0')
+		{
+			std::cerr << filename << ":" << lineNumber << ": bad hash '" << hash << "'\n";
+			continue;
+		}
+
+		entries[info.hash] = info;
+	}
+
+	return true;
+}
+
+RomInfo const* RomDatabase::Find(uint64_t hash) const
+{
+	auto entry = entries.find(hash);
+	return entry != entries.end() ? &entry->second : nullptr;
+}
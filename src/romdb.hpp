@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include "quirks.hpp"
+
+// Settings for a known ROM, looked up by a hash of its contents
+struct RomInfo
+{
+	uint64_t hash{};
+	QuirkProfile profile{DEFAULT_QUIRK_PROFILE};
+	unsigned int instructionsPerFrame{}; // Zero when the ROM has no preference
+	char keyMap[16]{};                   // Host key for each CHIP-8 key, zero for the default
+	std::string name;
+};
+
+// 64-bit FNV-1a of the ROM bytes
+uint64_t RomHash(uint8_t const* data, size_t size);
+bool RomHashFile(char const* filename, uint64_t& hash);
+
+// Text database, one ROM per line: <hash in hex> <profile> [ipf=<n>]
+// [keys=<16 host keys>] <name>. Blank lines and lines starting with '#'
+// are ignored.
+class RomDatabase
+{
+public:
+	bool Load(char const* filename);
+	RomInfo const* Find(uint64_t hash) const;
+
+private:
+	std::unordered_map<uint64_t, RomInfo> entries;
+};
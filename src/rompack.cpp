@@ -0,0 +1,173 @@
+#include "rompack.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "romdb.hpp"
+
+RomPack::~RomPack()
+{
+	Close();
+}
+
+void RomPack::Close()
+{
+	if (base != nullptr)
+	{
+		munmap(const_cast<char*>(base), size);
+	}
+	base = nullptr;
+	size = 0;
+	header = nullptr;
+	entries = nullptr;
+	hashIndex = nullptr;
+}
+
+bool RomPack::Open(char const* filename)
+{
+	Close();
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+	void* mapping = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(RomPackHeader))
+	{
+		mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+
+	if (mapping == MAP_FAILED)
+	{
+		return false;
+	}
+
+	base = static_cast<char const*>(mapping);
+	size = info.st_size;
+	header = reinterpret_cast<RomPackHeader const*>(base);
+
+	uint64_t count = header->count;
+	uint64_t indexEnd = header->hashIndexOffset + count * sizeof(uint32_t);
+	if (std::memcmp(header->magic, ROM_PACK_MAGIC, sizeof(ROM_PACK_MAGIC)) != 0
+		|| header->version != ROM_PACK_VERSION
+		|| header->hashIndexOffset != sizeof(RomPackHeader) + count * sizeof(RomPackEntry)
+		|| indexEnd > size)
+	{
+		Close();
+		return false;
+	}
+
+	entries = reinterpret_cast<RomPackEntry const*>(base + sizeof(RomPackHeader));
+	hashIndex = reinterpret_cast<uint32_t const*>(base + header->hashIndexOffset);
+
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		RomPackEntry const& entry = entries[i];
+		bool valid = hashIndex[i] < count
+			&& entry.profile <= static_cast<uint8_t>(QuirkProfile::Modern)
+			&& entry.nameOffset >= indexEnd && entry.nameOffset < size
+			&& std::memchr(base + entry.nameOffset, '\0', size - entry.nameOffset) != nullptr
+			&& entry.dataOffset <= size && entry.dataSize <= size - entry.dataOffset;
+
+		if (!valid)
+		{
+			Close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+RomPackEntry const* RomPack::FindName(char const* name) const
+{
+	RomPackEntry const* end = entries + Count();
+	RomPackEntry const* entry = std::lower_bound(entries, end, name,
+		[this](RomPackEntry const& entry, char const* name) { return std::strcmp(Name(entry), name) < 0; });
+
+	return entry != end && std::strcmp(Name(*entry), name) == 0 ? entry : nullptr;
+}
+
+RomPackEntry const* RomPack::FindHash(uint64_t hash) const
+{
+	uint32_t const* end = hashIndex + Count();
+	uint32_t const* slot = std::lower_bound(hashIndex, end, hash,
+		[this](uint32_t entry, uint64_t hash) { return entries[entry].hash < hash; });
+
+	return slot != end && entries[*slot].hash == hash ? &entries[*slot] : nullptr;
+}
+
+bool WriteRomPack(char const* filename, std::vector<RomPackInput> const& roms)
+{
+	std::vector<RomPackInput const*> sorted;
+	for (RomPackInput const& rom : roms)
+	{
+		sorted.push_back(&rom);
+	}
+	std::sort(sorted.begin(), sorted.end(),
+		[](RomPackInput const* a, RomPackInput const* b) { return a->name < b->name; });
+
+	uint32_t count = sorted.size();
+	RomPackHeader header;
+	std::memcpy(header.magic, ROM_PACK_MAGIC, sizeof(ROM_PACK_MAGIC));
+	header.version = ROM_PACK_VERSION;
+	header.count = count;
+	header.hashIndexOffset = sizeof(RomPackHeader) + count * sizeof(RomPackEntry);
+
+	uint32_t nameOffset = header.hashIndexOffset + count * sizeof(uint32_t);
+	uint32_t dataOffset = nameOffset;
+	for (RomPackInput const* rom : sorted)
+	{
+		dataOffset += rom->name.size() + 1;
+	}
+
+	std::vector<RomPackEntry> entries(count);
+	std::vector<uint32_t> hashIndex(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		RomPackInput const& rom = *sorted[i];
+		RomPackEntry& entry = entries[i];
+		std::memset(&entry, 0, sizeof(entry));
+
+		entry.hash = RomHash(rom.data.data(), rom.data.size());
+		entry.nameOffset = nameOffset;
+		entry.dataOffset = dataOffset;
+		entry.dataSize = rom.data.size();
+		entry.profile = static_cast<uint8_t>(rom.profile);
+		entry.instructionsPerFrame = std::min(rom.instructionsPerFrame, 255u);
+		std::memcpy(entry.keyMap, rom.keyMap, sizeof(entry.keyMap));
+
+		nameOffset += rom.name.size() + 1;
+		dataOffset += rom.data.size();
+		hashIndex[i] = i;
+	}
+	std::sort(hashIndex.begin(), hashIndex.end(),
+		[&entries](uint32_t a, uint32_t b) { return entries[a].hash < entries[b].hash; });
+
+	std::ofstream file(filename, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+	file.write(reinterpret_cast<char const*>(entries.data()), count * sizeof(RomPackEntry));
+	file.write(reinterpret_cast<char const*>(hashIndex.data()), count * sizeof(uint32_t));
+	for (RomPackInput const* rom : sorted)
+	{
+		file.write(rom->name.c_str(), rom->name.size() + 1);
+	}
+	for (RomPackInput const* rom : sorted)
+	{
+		file.write(reinterpret_cast<char const*>(rom->data.data()), rom->data.size());
+	}
+
+	return file.good();
+}
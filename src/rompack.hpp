@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "quirks.hpp"
+
+// Single-file ROM archive, read in place through a memory mapping.
+// Layout, little endian:
+//   RomPackHeader
+//   RomPackEntry[count], sorted by name
+//   uint32_t[count], entry numbers sorted by hash
+//   names, NUL terminated
+//   ROM data
+const char ROM_PACK_MAGIC[4] = {'C', '8', 'P', 'K'};
+const uint32_t ROM_PACK_VERSION = 1;
+
+struct RomPackHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t hashIndexOffset;
+};
+
+struct RomPackEntry
+{
+	uint64_t hash;
+	uint32_t nameOffset;
+	uint32_t dataOffset;
+	uint32_t dataSize;
+	uint8_t profile;
+	uint8_t instructionsPerFrame; // Zero when the ROM has no preference
+	// Host key (a lowercase character) for each CHIP-8 key, zero for the default
+	char keyMap[16];
+	uint8_t reserved[2];
+};
+
+class RomPack
+{
+public:
+	RomPack() = default;
+	~RomPack();
+	RomPack(RomPack const&) = delete;
+	RomPack& operator=(RomPack const&) = delete;
+
+	// Maps the file and checks every offset in it, so entries can be
+	// used afterwards without further checks
+	bool Open(char const* filename);
+
+	size_t Count() const { return header != nullptr ? header->count : 0; }
+	RomPackEntry const& Entry(size_t entry) const { return entries[entry]; }
+
+	RomPackEntry const* FindName(char const* name) const;
+	RomPackEntry const* FindHash(uint64_t hash) const;
+
+	char const* Name(RomPackEntry const& entry) const { return base + entry.nameOffset; }
+	uint8_t const* Data(RomPackEntry const& entry) const { return reinterpret_cast<uint8_t const*>(base) + entry.dataOffset; }
+	QuirkProfile Profile(RomPackEntry const& entry) const { return static_cast<QuirkProfile>(entry.profile); }
+
+private:
+	void Close();
+
+	char const* base{};
+	size_t size{};
+	RomPackHeader const* header{};
+	RomPackEntry const* entries{};
+	uint32_t const* hashIndex{};
+};
+
+// A ROM to put in a pack, with its metadata
+struct RomPackInput
+{
+	std::string name;
+	std::vector<uint8_t> data;
+	QuirkProfile profile{DEFAULT_QUIRK_PROFILE};
+	unsigned int instructionsPerFrame{};
+	char keyMap[16]{};
+};
+
+bool WriteRomPack(char const* filename, std::vector<RomPackInput> const& roms);
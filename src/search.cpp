@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "chip8.hpp"
+
+// Set of state hashes shared by all search threads. Open addressing
+// over atomic slots: inserting is a compare-and-swap, with no locks.
+class TranspositionTable
+{
+public:
+	explicit TranspositionTable(unsigned int bits)
+		: mask((size_t(1) << bits) - 1), slots(new std::atomic<uint64_t>[mask + 1])
+	{
+		for (size_t i = 0; i <= mask; ++i)
+		{
+			slots[i].store(0, std::memory_order_relaxed);
+		}
+	}
+
+	~TranspositionTable()
+	{
+		delete[] slots;
+	}
+
+	// True if the hash was not in the table yet. Zero marks empty slots,
+	// so a state hashing to zero is never deduplicated.
+	bool Insert(uint64_t hash)
+	{
+		if (hash == 0)
+		{
+			return true;
+		}
+
+		for (size_t probe = 0, slot = hash & mask; probe <= mask; ++probe, slot = (slot + 1) & mask)
+		{
+			uint64_t current = slots[slot].load(std::memory_order_relaxed);
+			if (current == hash)
+			{
+				return false;
+			}
+			if (current == 0)
+			{
+				uint64_t expected = 0;
+				if (slots[slot].compare_exchange_strong(expected, hash, std::memory_order_relaxed))
+				{
+					size.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+				if (expected == hash)
+				{
+					return false;
+				}
+			}
+		}
+
+		// Full: stop deduplicating rather than failing the search
+		return true;
+	}
+
+	size_t Size() const { return size.load(std::memory_order_relaxed); }
+
+private:
+	size_t mask;
+	std::atomic<uint64_t>* slots;
+	std::atomic<size_t> size{0};
+};
+
+// What the search is looking for. The score ranks states in the beam;
+// reaching the goal ends the search.
+struct Goal
+{
+	int targetPc = -1;
+	int scoreAddress = -1;
+	int scoreTarget = -1;
+	std::vector<int8_t> pattern; // Per pixel: 1 lit, 0 dark, -1 don't care
+	unsigned int patternPixels = 0;
+
+	unsigned int PatternMatches(Chip8 const& chip8) const
+	{
+		unsigned int matches = 0;
+		for (unsigned int i = 0; i < pattern.size(); ++i)
+		{
+			matches += pattern[i] >= 0 && (chip8.display[i] != 0) == (pattern[i] != 0);
+		}
+		return matches;
+	}
+
+	// The score byte dominates, pattern matches break ties
+	long Score(Chip8 const& chip8) const
+	{
+		long score = PatternMatches(chip8);
+		if (scoreAddress >= 0)
+		{
+			score += chip8.ReadMemory(scoreAddress) * long(DISPLAY_WIDTH * DISPLAY_HEIGHT + 1);
+		}
+		return score;
+	}
+
+	bool Reached(Chip8 const& chip8, bool pcReached) const
+	{
+		if (pcReached)
+		{
+			return true;
+		}
+		if (scoreAddress >= 0 && scoreTarget >= 0 && chip8.ReadMemory(scoreAddress) >= scoreTarget)
+		{
+			return true;
+		}
+		return !pattern.empty() && PatternMatches(chip8) == patternPixels;
+	}
+};
+
+struct SearchSettings
+{
+	unsigned int beamWidth = 256;
+	unsigned int maxSteps = 150;
+	unsigned int framesPerStep = 4;
+	unsigned int cyclesPerFrame = DEFAULT_CYCLES_PER_FRAME;
+	unsigned int threads = 1;
+	std::vector<uint16_t> actions;
+};
+
+// One expansion of a beam node by one action
+struct Candidate
+{
+	uint32_t parent;
+	uint16_t keys;
+	long score;
+	uint64_t hash;
+	bool reached;
+};
+
+// A node kept in the beam, linked to its parent to rebuild the movie
+struct Step
+{
+	uint32_t parent;
+	uint16_t keys;
+};
+
+// Hold the keys for a number of frames. Returns true if the target PC
+// was about to execute at any point.
+static bool Advance(Chip8& chip8, uint16_t keys, SearchSettings const& settings, int targetPc)
+{
+	for (unsigned int key = 0; key < KEY_COUNT; ++key)
+	{
+		chip8.keyPad[key] = (keys >> key) & 1u;
+	}
+
+	bool reached = false;
+	for (unsigned int frame = 0; frame < settings.framesPerStep; ++frame)
+	{
+		chip8.UpdateTimers();
+		for (unsigned int i = 0; i < settings.cyclesPerFrame && chip8.GetTrap() == Trap::None; ++i)
+		{
+			reached |= static_cast<int>(chip8.GetState().programCounter & ADDRESS_MASK) == targetPc;
+			chip8.EmulateCycle();
+		}
+	}
+	return reached;
+}
+
+// Run body(worker, item) for every item on all threads
+template<typename Body>
+static void ParallelFor(unsigned int threads, size_t count, Body body)
+{
+	std::atomic<size_t> next{0};
+	std::vector<std::thread> workers;
+
+	for (unsigned int worker = 0; worker < threads; ++worker)
+	{
+		workers.emplace_back([&, worker]()
+		{
+			for (size_t item = next++; item < count; item = next++)
+			{
+				body(worker, item);
+			}
+		});
+	}
+
+	for (std::thread& thread : workers)
+	{
+		thread.join();
+	}
+}
+
+static bool LoadPattern(char const* filename, Goal& goal)
+{
+	std::ifstream file(filename);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	// Rows of '#' (lit), '.' (dark) and anything else (don't care)
+	goal.pattern.assign(DISPLAY_WIDTH * DISPLAY_HEIGHT, -1);
+	std::string line;
+	for (unsigned int y = 0; y < DISPLAY_HEIGHT && std::getline(file, line); ++y)
+	{
+		for (unsigned int x = 0; x < DISPLAY_WIDTH && x < line.size(); ++x)
+		{
+			int8_t pixel = line[x] == '#' ? 1 : line[x] == '.' ? 0 : -1;
+			goal.pattern[y * DISPLAY_WIDTH + x] = pixel;
+			goal.patternPixels += pixel >= 0;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	char const* romFilename = nullptr;
+	char const* movieFilename = nullptr;
+	QuirkProfile profile = DEFAULT_QUIRK_PROFILE;
+	SearchSettings settings;
+	settings.threads = std::max(1u, std::thread::hardware_concurrency());
+	Goal goal;
+	uint64_t seed = 1;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--target-pc") == 0 && i + 1 < argc)
+		{
+			goal.targetPc = std::strtoul(argv[++i], nullptr, 16) & ADDRESS_MASK;
+		}
+		else if (std::strcmp(argv[i], "--score") == 0 && i + 1 < argc)
+		{
+			goal.scoreAddress = std::strtoul(argv[++i], nullptr, 16) & ADDRESS_MASK;
+		}
+		else if (std::strcmp(argv[i], "--score-target") == 0 && i + 1 < argc)
+		{
+			goal.scoreTarget = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--pattern") == 0 && i + 1 < argc)
+		{
+			if (!LoadPattern(argv[++i], goal))
+			{
+				std::cerr << "Cannot load " << argv[i] << "\n";
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		else if (std::strcmp(argv[i], "--keys") == 0 && i + 1 < argc)
+		{
+			// Comma-separated hex key masks, one per action
+			for (char* key = argv[++i]; *key != '\0'; )
+			{
+				settings.actions.push_back(std::strtoul(key, &key, 16));
+				key += *key == ',';
+			}
+		}
+		else if (std::strcmp(argv[i], "--beam") == 0 && i + 1 < argc)
+		{
+			settings.beamWidth = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+		{
+			settings.maxSteps = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--frames-per-step") == 0 && i + 1 < argc)
+		{
+			settings.framesPerStep = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--cycles-per-frame") == 0 && i + 1 < argc)
+		{
+			settings.cyclesPerFrame = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			settings.threads = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+		}
+		else if (std::strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+		{
+			if (!ParseQuirkProfile(argv[++i], profile))
+			{
+				std::cerr << "Unknown profile " << argv[i] << ", expected vip, chip48, schip or modern\n";
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		else if (std::strcmp(argv[i], "--movie") == 0 && i + 1 < argc)
+		{
+			movieFilename = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = std::strtoull(argv[++i], nullptr, 10);
+		}
+		else if (romFilename == nullptr && argv[i][0] != '-')
+		{
+			romFilename = argv[i];
+		}
+		else
+		{
+			romFilename = nullptr;
+			break;
+		}
+	}
+
+	if (romFilename == nullptr || (goal.targetPc < 0 && goal.scoreAddress < 0 && goal.pattern.empty()))
+	{
+		std::cerr << "Usage: " << argv[0] << " (--target-pc <addr> | --score <addr> [--score-target <n>] | --pattern <file>)\n"
+			<< "       [--keys <mask>,<mask>...] [--beam <n>] [--steps <n>] [--frames-per-step <n>]\n"
+			<< "       [--cycles-per-frame <n>] [--threads <n>] [--profile <name>] [--movie <file>] [--seed <n>] <ROM>\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	if (settings.actions.empty())
+	{
+		// No key, then each key on its own
+		settings.actions.push_back(0);
+		for (unsigned int key = 0; key < KEY_COUNT; ++key)
+		{
+			settings.actions.push_back(1u << key);
+		}
+	}
+
+	Chip8 root;
+	root.SetQuirkProfile(profile);
+	root.Seed(seed);
+	if (!root.LoadROM(romFilename))
+	{
+		std::cerr << "Cannot load " << romFilename << "\n";
+		std::exit(EXIT_FAILURE);
+	}
+
+	TranspositionTable seen(24);
+	seen.Insert(root.Hash());
+
+	std::vector<Chip8> machines(settings.threads);
+	for (Chip8& chip8 : machines)
+	{
+		chip8.SetQuirkProfile(profile);
+	}
+
+	std::vector<Chip8State> beam(1);
+	root.SaveState(beam[0]);
+	std::vector<std::vector<Step>> layers;
+	std::vector<Candidate> candidates;
+
+	long bestScore = goal.Score(root);
+	unsigned int bestDepth = 0;
+	bool found = false;
+	unsigned long expanded = 0;
+	unsigned int steps = 0;
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned int depth = 0; depth < settings.maxSteps && !beam.empty() && !found; ++depth)
+	{
+		size_t actionCount = settings.actions.size();
+		candidates.resize(beam.size() * actionCount);
+
+		// Expand every beam node by every action, keeping only hashes and scores
+		ParallelFor(settings.threads, candidates.size(), [&](unsigned int worker, size_t item)
+		{
+			Chip8& chip8 = machines[worker];
+			Candidate& candidate = candidates[item];
+			candidate.parent = item / actionCount;
+			candidate.keys = settings.actions[item % actionCount];
+
+			chip8.LoadState(beam[candidate.parent]);
+			bool pcReached = Advance(chip8, candidate.keys, settings, goal.targetPc);
+
+			candidate.hash = chip8.Hash();
+			candidate.score = goal.Score(chip8);
+			candidate.reached = goal.Reached(chip8, pcReached);
+
+			// Trapped or already seen states are dropped
+			if (chip8.GetTrap() != Trap::None || (!candidate.reached && !seen.Insert(candidate.hash)))
+			{
+				candidate.score = -1;
+			}
+		});
+		expanded += candidates.size();
+		++steps;
+
+		candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+			[](Candidate const& candidate) { return candidate.score < 0; }), candidates.end());
+
+		// Goal states first, then best score. Hashes break ties, which
+		// spreads the beam over unrelated states.
+		auto better = [](Candidate const& a, Candidate const& b)
+		{
+			if (a.reached != b.reached)
+			{
+				return a.reached;
+			}
+			return a.score != b.score ? a.score > b.score : a.hash < b.hash;
+		};
+
+		if (candidates.size() > settings.beamWidth)
+		{
+			std::nth_element(candidates.begin(), candidates.begin() + settings.beamWidth, candidates.end(), better);
+			candidates.resize(settings.beamWidth);
+		}
+		std::sort(candidates.begin(), candidates.end(), better);
+
+		layers.emplace_back();
+		std::vector<Step>& layer = layers.back();
+		for (Candidate const& candidate : candidates)
+		{
+			layer.push_back(Step{ candidate.parent, candidate.keys });
+		}
+
+		if (!candidates.empty() && (candidates[0].reached || candidates[0].score > bestScore))
+		{
+			found = candidates[0].reached;
+			bestScore = candidates[0].score;
+			bestDepth = depth + 1;
+		}
+
+		// Re-run the kept expansions to get their states for the next step
+		std::vector<Chip8State> next(candidates.size());
+		ParallelFor(settings.threads, candidates.size(), [&](unsigned int worker, size_t item)
+		{
+			Chip8& chip8 = machines[worker];
+			chip8.LoadState(beam[candidates[item].parent]);
+			Advance(chip8, candidates[item].keys, settings, -1);
+			chip8.SaveState(next[item]);
+		});
+		beam.swap(next);
+	}
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::printf("%s after %u steps, best score %ld, %lu expansions in %.2fs (%.0f/s), %zu unique states\n",
+		found ? "Goal reached" : "Goal not reached", steps, bestScore,
+		expanded, elapsed, expanded / elapsed, seen.Size());
+
+	// Without --movie, only the summary above is printed
+	if (movieFilename == nullptr)
+	{
+		return found ? EXIT_SUCCESS : 1;
+	}
+
+	// Walk back from the best node, always first in its sorted layer,
+	// to rebuild the key sequence
+	std::vector<uint16_t> movie;
+	for (uint32_t depth = bestDepth, node = 0; depth > 0; --depth)
+	{
+		Step const& step = layers[depth - 1][node];
+		movie.insert(movie.begin(), settings.framesPerStep, step.keys);
+		node = step.parent;
+	}
+
+	std::ofstream file(movieFilename);
+	for (uint16_t keys : movie)
+	{
+		char line[8];
+		std::snprintf(line, sizeof(line), "%.4X\n", keys);
+		file << line;
+	}
+	std::printf("Wrote %zu frames of input to %s, replay with --seed %llu --movie %s\n",
+		movie.size(), movieFilename, static_cast<unsigned long long>(seed), movieFilename);
+
+	return found ? EXIT_SUCCESS : 1;
+}
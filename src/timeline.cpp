@@ -0,0 +1,150 @@
+#include "timeline.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+const unsigned int TIMELINE_RING_SIZE = 1u << 16;
+
+std::atomic<bool> timelineActive{false};
+
+static std::chrono::steady_clock::time_point const timelineEpoch = std::chrono::steady_clock::now();
+
+// Fields are relaxed atomics so that the writer may read a ring while its
+// thread keeps recording; the head tells it which events are whole
+struct TimelineEvent
+{
+	std::atomic<char const*> name{nullptr};
+	std::atomic<uint64_t> start{0};
+	std::atomic<uint64_t> end{0};
+};
+
+struct TimelineRing
+{
+	unsigned int thread{};
+	std::atomic<char const*> threadName{nullptr};
+	std::atomic<uint32_t> head{0};
+	TimelineEvent events[TIMELINE_RING_SIZE];
+};
+
+// Rings live until the process exits, so a thread that has finished
+// still shows up in later dumps
+static std::mutex ringsMutex;
+static std::vector<std::unique_ptr<TimelineRing>> rings;
+static thread_local TimelineRing* threadRing = nullptr;
+
+static TimelineRing& ThreadRing()
+{
+	if (threadRing == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		rings.emplace_back(new TimelineRing());
+		threadRing = rings.back().get();
+		threadRing->thread = rings.size();
+	}
+	return *threadRing;
+}
+
+void SetTimelineActive(bool active)
+{
+	timelineActive.store(active, std::memory_order_relaxed);
+}
+
+uint64_t TimelineNow()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - timelineEpoch).count();
+}
+
+void TimelineRecord(char const* name, uint64_t start, uint64_t end)
+{
+	TimelineRing& ring = ThreadRing();
+	uint32_t position = ring.head.load(std::memory_order_relaxed);
+	TimelineEvent& event = ring.events[position & (TIMELINE_RING_SIZE - 1)];
+	event.name.store(name, std::memory_order_relaxed);
+	event.start.store(start, std::memory_order_relaxed);
+	event.end.store(end, std::memory_order_relaxed);
+	ring.head.store(position + 1, std::memory_order_release);
+}
+
+void SetTimelineThreadName(char const* name)
+{
+	ThreadRing().threadName.store(name, std::memory_order_relaxed);
+}
+
+struct CopiedEvent
+{
+	char const* name;
+	uint64_t start;
+	uint64_t end;
+};
+
+// Copy the events still in the ring, dropping any the thread may have
+// overwritten while they were read
+static void CopyRing(TimelineRing const& ring, std::vector<CopiedEvent>& events)
+{
+	uint32_t head = ring.head.load(std::memory_order_acquire);
+	uint32_t first = head > TIMELINE_RING_SIZE ? head - TIMELINE_RING_SIZE : 0;
+
+	events.clear();
+	for (uint32_t position = first; position != head; ++position)
+	{
+		TimelineEvent const& event = ring.events[position & (TIMELINE_RING_SIZE - 1)];
+		events.push_back(CopiedEvent{ event.name.load(std::memory_order_relaxed),
+			event.start.load(std::memory_order_relaxed), event.end.load(std::memory_order_relaxed) });
+	}
+
+	// The slot of the event at the new head may be half written too
+	uint32_t newHead = ring.head.load(std::memory_order_acquire);
+	uint32_t overwritten = newHead - first >= TIMELINE_RING_SIZE ? newHead - first - TIMELINE_RING_SIZE + 1 : 0;
+	events.erase(events.begin(), events.begin() + std::min<size_t>(overwritten, events.size()));
+}
+
+bool WriteTimeline(std::string const& filename, uint64_t from, uint64_t to)
+{
+	std::string temporary = filename + ".tmp";
+	FILE* file = std::fopen(temporary.c_str(), "w");
+	if (file == nullptr)
+	{
+		return false;
+	}
+
+	std::vector<TimelineRing const*> snapshot;
+	{
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		for (std::unique_ptr<TimelineRing> const& ring : rings)
+		{
+			snapshot.push_back(ring.get());
+		}
+	}
+
+	// Complete ("X") events with microsecond timestamps, plus a metadata
+	// event naming each thread
+	std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	char const* separator = "";
+	std::vector<CopiedEvent> events;
+	for (TimelineRing const* ring : snapshot)
+	{
+		char const* threadName = ring->threadName.load(std::memory_order_relaxed);
+		std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+			separator, ring->thread, threadName != nullptr ? threadName : "thread");
+		separator = ",\n";
+
+		CopyRing(*ring, events);
+		for (CopiedEvent const& event : events)
+		{
+			if (event.start < from || event.start >= to)
+			{
+				continue;
+			}
+			std::fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"host\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				event.name, ring->thread, event.start * 1e-3, (event.end - event.start) * 1e-3);
+		}
+	}
+	std::fprintf(file, "\n]}\n");
+
+	bool written = !std::ferror(file);
+	written = std::fclose(file) == 0 && written;
+	return written && std::rename(temporary.c_str(), filename.c_str()) == 0;
+}
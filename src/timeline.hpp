@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Timeline of host-side work, such as the stages of a frame, written out
+// as Chrome trace-event JSON for Perfetto or chrome://tracing. Every
+// thread records into its own ring, so recording takes no lock. While the
+// timeline is inactive, a scope costs one relaxed load.
+
+extern std::atomic<bool> timelineActive;
+
+inline bool TimelineActive()
+{
+	return timelineActive.load(std::memory_order_relaxed);
+}
+
+void SetTimelineActive(bool active);
+
+// Nanoseconds since the process started
+uint64_t TimelineNow();
+
+// Record an event into the calling thread's ring, overwriting the oldest
+// once it is full. The name must outlive the timeline, like a literal.
+void TimelineRecord(char const* name, uint64_t start, uint64_t end);
+
+// Name the calling thread in the output
+void SetTimelineThreadName(char const* name);
+
+// Write the events that started in [from, to) nanoseconds. The file is
+// written under a temporary name and renamed.
+bool WriteTimeline(std::string const& filename, uint64_t from, uint64_t to);
+
+// Records the time from construction to destruction, if the timeline was
+// active at construction
+class TimelineScope
+{
+public:
+	explicit TimelineScope(char const* name)
+		: name(name), recording(TimelineActive()), start(recording ? TimelineNow() : 0)
+	{
+	}
+
+	~TimelineScope()
+	{
+		if (recording)
+		{
+			TimelineRecord(name, start, TimelineNow());
+		}
+	}
+
+	TimelineScope(TimelineScope const&) = delete;
+	TimelineScope& operator=(TimelineScope const&) = delete;
+
+private:
+	char const* name;
+	bool recording;
+	uint64_t start;
+};
+
+#define TIMELINE_CONCAT_INNER(a, b) a##b
+#define TIMELINE_CONCAT(a, b) TIMELINE_CONCAT_INNER(a, b)
+
+// Time the rest of the enclosing block
+#define TIMELINE_SCOPE(name) TimelineScope TIMELINE_CONCAT(timelineScope, __LINE__)(name)
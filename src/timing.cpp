@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cstdio>
+#include "timing.hpp"
+
+// Interpreter overhead paid by every instruction
+const unsigned int FETCH_CYCLES = 40;
+// Extra cycles when a conditional skip is taken
+const unsigned int SKIP_CYCLES = 4;
+
+static unsigned int SkipCost(unsigned int cost, bool taken)
+{
+	return cost + (taken ? SKIP_CYCLES : 0);
+}
+
+// The VIP draws a row by shifting the sprite byte into place one bit at a
+// time and XORing one byte, or two when X is not a multiple of 8. Rows
+// below the bottom edge are clipped and cost nothing.
+static unsigned int DrawCost(unsigned int x, unsigned int y, unsigned int height)
+{
+	x %= DISPLAY_WIDTH;
+	y %= DISPLAY_HEIGHT;
+	unsigned int rows = height < DISPLAY_HEIGHT - y ? height : DISPLAY_HEIGHT - y;
+	unsigned int shift = x & 7u;
+	unsigned int bytes = shift != 0 && x < DISPLAY_WIDTH - 8 ? 2 : 1;
+
+	return 26 + rows * (16 + 4 * shift + 8 * bytes);
+}
+
+// FX33 divides by repeated subtraction, so the cost grows with each digit
+static unsigned int DecimalCost(unsigned int value)
+{
+	return 80 + 16 * (value / 100 + value / 10 % 10 + value % 10);
+}
+
+unsigned int InstructionCycles(Chip8 const& chip8)
+{
+	Chip8Core const& state = chip8.GetState();
+	unsigned int pc = state.programCounter & ADDRESS_MASK;
+	unsigned int opcode = chip8.ReadMemory(pc) << 8u | chip8.ReadMemory(pc + 1);
+	unsigned int x = (opcode & 0x0F00u) >> 8u;
+	unsigned int y = (opcode & 0x00F0u) >> 4u;
+	uint8_t kk = opcode & 0x00FFu;
+	uint8_t vx = state.registers[x];
+	uint8_t vy = state.registers[y];
+
+	unsigned int cost = FETCH_CYCLES;
+
+	switch (opcode >> 12u)
+	{
+		case 0x0:
+			// 00E0 clears all 256 display bytes, 00EE pops the stack
+			cost += opcode == 0x00E0u ? 24 + 3072 : 10;
+			break;
+
+		case 0x1:
+			cost += 12;
+			break;
+
+		case 0x2:
+			cost += 26;
+			break;
+
+		case 0x3:
+			cost += SkipCost(10, vx == kk);
+			break;
+
+		case 0x4:
+			cost += SkipCost(10, vx != kk);
+			break;
+
+		case 0x5:
+			cost += SkipCost(14, vx == vy);
+			break;
+
+		case 0x6:
+			cost += 6;
+			break;
+
+		case 0x7:
+			cost += 10;
+			break;
+
+		case 0x8:
+			// The VIP runs 8XYN as a generated 1802 subroutine
+			cost += (opcode & 0xFu) == 0 ? 12 : 44;
+			break;
+
+		case 0x9:
+			cost += SkipCost(14, vx != vy);
+			break;
+
+		case 0xA:
+			cost += 12;
+			break;
+
+		case 0xB:
+			cost += 22;
+			break;
+
+		case 0xC:
+			cost += 36;
+			break;
+
+		case 0xD:
+			cost += DrawCost(vx, vy, opcode & 0xFu);
+			break;
+
+		case 0xE:
+			cost += SkipCost(14, state.keyPad[vx & 0xFu] == (kk == 0x9Eu));
+			break;
+
+		case 0xF:
+			switch (kk)
+			{
+				case 0x1E:
+				case 0x29:
+					cost += 16;
+					break;
+
+				case 0x33:
+					cost += DecimalCost(vx);
+					break;
+
+				case 0x55:
+				case 0x65:
+					cost += 14 + 14 * (x + 1);
+					break;
+
+				case 0x0A:
+					cost += 38;
+					break;
+
+				default:
+					cost += 10;
+					break;
+			}
+			break;
+	}
+
+	return cost;
+}
+
+FrameScheduler::FrameScheduler(unsigned int instructionsPerFrame, unsigned int cycleBudget, bool countCycles)
+	: instructionsPerFrame(instructionsPerFrame), cycleBudget(cycleBudget), countCycles(countCycles)
+{
+}
+
+void FrameScheduler::RunFrame(Chip8& chip8)
+{
+	if (cycleBudget == 0 && !countCycles)
+	{
+		++frames;
+		instructions += chip8.RunFrame(instructionsPerFrame);
+		return;
+	}
+
+	BeginFrame(chip8);
+	while (!FrameDone(chip8))
+	{
+		Step(chip8);
+	}
+}
+
+void FrameScheduler::BeginFrame(Chip8& chip8)
+{
+	chip8.UpdateTimers();
+	++frames;
+	left = instructionsPerFrame;
+
+	// An instruction that overruns the budget finishes anyway and the
+	// next frame starts that much shorter. Credit left over by a frame
+	// that was cut short is dropped, like the rest of that frame.
+	credit = std::min(credit, 0L) + static_cast<long>(cycleBudget);
+}
+
+bool FrameScheduler::FrameDone(Chip8 const& chip8) const
+{
+	return (cycleBudget != 0 ? credit <= 0 : left == 0) || chip8.GetTrap() != Trap::None;
+}
+
+void FrameScheduler::Step(Chip8& chip8)
+{
+	unsigned int cost = cycleBudget != 0 || countCycles ? InstructionCycles(chip8) : 0;
+	chip8.EmulateCycle();
+	credit -= cost;
+	--left;
+	cycles += cost;
+	++instructions;
+}
+
+void PrintStats(FrameScheduler const& scheduler)
+{
+	double frames = scheduler.Frames() > 0 ? scheduler.Frames() : 1;
+	double instructions = scheduler.Instructions() > 0 ? scheduler.Instructions() : 1;
+
+	std::printf("Frames: %llu (%.2fs emulated), instructions: %llu (%.1f per frame), "
+		"VIP cycles: %llu (%.0f per frame, %.1f per instruction)\n",
+		static_cast<unsigned long long>(scheduler.Frames()), scheduler.Frames() / double(TIMER_FREQUENCY),
+		static_cast<unsigned long long>(scheduler.Instructions()), scheduler.Instructions() / frames,
+		static_cast<unsigned long long>(scheduler.Cycles()), scheduler.Cycles() / frames,
+		scheduler.Cycles() / instructions);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include "chip8.hpp"
+
+// COSMAC VIP machine cycles (8 clocks of the 1.7609 MHz CDP1802) in one
+// 60 Hz frame, and the share taken by the display DMA and interrupt
+const unsigned int VIP_FRAME_CYCLES = 3668;
+const unsigned int VIP_DISPLAY_CYCLES = 1024 + 50;
+const unsigned int VIP_CYCLE_BUDGET = VIP_FRAME_CYCLES - VIP_DISPLAY_CYCLES;
+
+// Approximate VIP machine cycles taken by the instruction about to
+// execute, including the interpreter's fetch and decode
+unsigned int InstructionCycles(Chip8 const& chip8);
+
+// Runs frames either by a fixed instruction count or by a VIP cycle
+// budget, and counts frames, instructions and modelled cycles
+class FrameScheduler
+{
+public:
+	// A cycle budget of zero runs instructionsPerFrame instructions per
+	// frame through Chip8::RunFrame, which fuses instructions. Modelling
+	// their cycles as well means running them one at a time, so a fixed
+	// count only does that when countCycles is set, as for --stats.
+	FrameScheduler(unsigned int instructionsPerFrame, unsigned int cycleBudget, bool countCycles = false);
+
+	void RunFrame(Chip8& chip8);
+
+	// One instruction at a time, for callers that look at the machine
+	// between instructions, such as the debugger. RunFrame is BeginFrame
+	// followed by Step until FrameDone. A frame can be cut short by
+	// calling BeginFrame early.
+	void BeginFrame(Chip8& chip8);
+	bool FrameDone(Chip8 const& chip8) const;
+	void Step(Chip8& chip8);
+
+	uint64_t Frames() const { return frames; }
+	uint64_t Instructions() const { return instructions; }
+	uint64_t Cycles() const { return cycles; }
+
+private:
+	unsigned int instructionsPerFrame;
+	unsigned int cycleBudget;
+	bool countCycles;
+	// Cycles left in the current frame, negative after an instruction
+	// that ran past the end of the previous one
+	long credit{};
+	// Instructions left in the current frame, with a fixed count
+	unsigned int left{};
+	uint64_t frames{};
+	uint64_t instructions{};
+	uint64_t cycles{};
+};
+
+// One-line summary of the counters, for performance analysis of ROMs
+void PrintStats(FrameScheduler const& scheduler);
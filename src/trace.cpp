@@ -0,0 +1,354 @@
+#include "trace.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#ifdef CHIP8_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+static char const TRACE_MAGIC[4] = { 'C', '8', 'T', 'R' };
+
+enum TraceFlags : uint8_t
+{
+	TRACE_PC = 1u << 0,
+	TRACE_INDEX = 1u << 1,
+	TRACE_REGISTERS = 1u << 2
+};
+
+static uint32_t ZigZag(int32_t value)
+{
+	return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+static int32_t UnZigZag(uint32_t value)
+{
+	return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1u);
+}
+
+TraceSink::TraceSink(char const* filename, bool compress)
+	: records(new TraceRecord[TRACE_BUFFER_SIZE])
+{
+#ifdef CHIP8_HAVE_ZLIB
+	// "T" writes a plain file through the same interface
+	file = gzopen(filename, compress ? "wb6" : "wbT");
+#else
+	(void)compress;
+	file = std::fopen(filename, "wb");
+#endif
+
+	if (file == nullptr)
+	{
+		return;
+	}
+
+	std::memcpy(output, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+	outputSize = sizeof(TRACE_MAGIC);
+	writer = std::thread(&TraceSink::Run, this);
+}
+
+TraceSink::~TraceSink()
+{
+	if (file != nullptr)
+	{
+		stopping.store(true, std::memory_order_release);
+		writer.join();
+		Flush();
+
+#ifdef CHIP8_HAVE_ZLIB
+		gzclose(static_cast<gzFile>(file));
+#else
+		std::fclose(static_cast<FILE*>(file));
+#endif
+	}
+
+	delete[] records;
+}
+
+void TraceSink::Run()
+{
+	for (;;)
+	{
+		// Read the flag first, so records pushed before it was set are
+		// seen by the load of head below
+		bool stop = stopping.load(std::memory_order_acquire);
+		uint32_t position = tail.load(std::memory_order_relaxed);
+		uint32_t end = head.load(std::memory_order_acquire);
+
+		if (position == end)
+		{
+			if (stop)
+			{
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+
+		for (; position != end; ++position)
+		{
+			Encode(records[position & (TRACE_BUFFER_SIZE - 1)]);
+		}
+
+		tail.store(end, std::memory_order_release);
+	}
+}
+
+void TraceSink::Encode(TraceRecord const& record)
+{
+	// Largest entry: flags, opcode, two 3-byte varints, mask and 16 registers
+	if (outputSize + 32 > sizeof(output))
+	{
+		Flush();
+	}
+
+	unsigned char* out = output + outputSize;
+	unsigned char* flags = out++;
+	*flags = 0;
+
+	*out++ = record.opcode >> 8;
+	*out++ = record.opcode & 0xFFu;
+
+	uint32_t deltas[2];
+	unsigned int deltaCount = 0;
+
+	if (record.pc != static_cast<uint16_t>(previousPc + 2))
+	{
+		*flags |= TRACE_PC;
+		deltas[deltaCount++] = ZigZag(record.pc - static_cast<int32_t>(previousPc + 2));
+	}
+	previousPc = record.pc;
+
+	if (record.indexChanged)
+	{
+		*flags |= TRACE_INDEX;
+		deltas[deltaCount++] = ZigZag(record.index - static_cast<int32_t>(previousIndex));
+		previousIndex = record.index;
+	}
+
+	for (unsigned int i = 0; i < deltaCount; ++i)
+	{
+		uint32_t value = deltas[i];
+		while (value >= 0x80u)
+		{
+			*out++ = static_cast<unsigned char>(value | 0x80u);
+			value >>= 7;
+		}
+		*out++ = static_cast<unsigned char>(value);
+	}
+
+	if (record.changedRegisters != 0)
+	{
+		*flags |= TRACE_REGISTERS;
+		*out++ = record.changedRegisters >> 8;
+		*out++ = record.changedRegisters & 0xFFu;
+		for (unsigned int i = 0; i < 16; ++i)
+		{
+			if (record.changedRegisters & (1u << i))
+			{
+				*out++ = record.registers[i];
+			}
+		}
+	}
+
+	outputSize = out - output;
+}
+
+void TraceSink::Flush()
+{
+#ifdef CHIP8_HAVE_ZLIB
+	gzwrite(static_cast<gzFile>(file), output, outputSize);
+#else
+	std::fwrite(output, 1, outputSize, static_cast<FILE*>(file));
+#endif
+	outputSize = 0;
+}
+
+TraceReader::TraceReader(char const* filename)
+{
+#ifdef CHIP8_HAVE_ZLIB
+	file = gzopen(filename, "rb");
+#else
+	file = std::fopen(filename, "rb");
+#endif
+
+	if (file == nullptr)
+	{
+		return;
+	}
+
+	char magic[4];
+	for (char& c : magic)
+	{
+		c = static_cast<char>(ReadByte());
+	}
+
+	if (std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+	{
+#ifdef CHIP8_HAVE_ZLIB
+		gzclose(static_cast<gzFile>(file));
+#else
+		std::fclose(static_cast<FILE*>(file));
+#endif
+		file = nullptr;
+	}
+}
+
+TraceReader::~TraceReader()
+{
+	if (file != nullptr)
+	{
+#ifdef CHIP8_HAVE_ZLIB
+		gzclose(static_cast<gzFile>(file));
+#else
+		std::fclose(static_cast<FILE*>(file));
+#endif
+	}
+}
+
+int TraceReader::ReadByte()
+{
+#ifdef CHIP8_HAVE_ZLIB
+	return gzgetc(static_cast<gzFile>(file));
+#else
+	return std::fgetc(static_cast<FILE*>(file));
+#endif
+}
+
+bool TraceReader::ReadVarint(uint32_t& value)
+{
+	value = 0;
+	for (unsigned int shift = 0; shift < 32; shift += 7)
+	{
+		int byte = ReadByte();
+		if (byte < 0)
+		{
+			return false;
+		}
+		value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool TraceReader::Next(TraceRecord& record)
+{
+	int flags = ReadByte();
+	int high = ReadByte();
+	int low = ReadByte();
+	if (flags < 0 || high < 0 || low < 0)
+	{
+		return false;
+	}
+
+	record = TraceRecord();
+	record.opcode = static_cast<uint16_t>(high << 8 | low);
+
+	record.pc = previousPc + 2;
+	if (flags & TRACE_PC)
+	{
+		uint32_t delta;
+		if (!ReadVarint(delta))
+		{
+			return false;
+		}
+		record.pc += UnZigZag(delta);
+	}
+	previousPc = record.pc;
+
+	record.index = previousIndex;
+	if (flags & TRACE_INDEX)
+	{
+		uint32_t delta;
+		if (!ReadVarint(delta))
+		{
+			return false;
+		}
+		record.indexChanged = true;
+		record.index += UnZigZag(delta);
+		previousIndex = record.index;
+	}
+
+	if (flags & TRACE_REGISTERS)
+	{
+		int maskHigh = ReadByte();
+		int maskLow = ReadByte();
+		if (maskHigh < 0 || maskLow < 0)
+		{
+			return false;
+		}
+
+		record.changedRegisters = static_cast<uint16_t>(maskHigh << 8 | maskLow);
+		for (unsigned int i = 0; i < 16; ++i)
+		{
+			if (record.changedRegisters & (1u << i))
+			{
+				int value = ReadByte();
+				if (value < 0)
+				{
+					return false;
+				}
+				record.registers[i] = static_cast<uint8_t>(value);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool SameRecord(TraceRecord const& a, TraceRecord const& b)
+{
+	if (a.pc != b.pc || a.opcode != b.opcode || a.changedRegisters != b.changedRegisters
+		|| a.indexChanged != b.indexChanged || (a.indexChanged && a.index != b.index))
+	{
+		return false;
+	}
+
+	for (unsigned int i = 0; i < 16; ++i)
+	{
+		if ((a.changedRegisters & (1u << i)) && a.registers[i] != b.registers[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+TraceDivergence DiffTraces(TraceReader& first, TraceReader& second, unsigned int contextSize)
+{
+	TraceDivergence divergence;
+	// The context is kept as a ring, and put in order at the end
+	std::vector<TraceRecord> history(contextSize);
+
+	for (;; ++divergence.step)
+	{
+		divergence.hasFirst = first.Next(divergence.first);
+		divergence.hasSecond = second.Next(divergence.second);
+
+		if (!divergence.hasFirst && !divergence.hasSecond)
+		{
+			divergence.identical = true;
+			return divergence;
+		}
+
+		if (!divergence.hasFirst || !divergence.hasSecond || !SameRecord(divergence.first, divergence.second))
+		{
+			break;
+		}
+
+		if (contextSize != 0)
+		{
+			history[divergence.step % contextSize] = divergence.first;
+		}
+	}
+
+	unsigned long from = divergence.step >= contextSize ? divergence.step - contextSize : 0;
+	for (unsigned long i = from; i < divergence.step; ++i)
+	{
+		divergence.context.push_back(history[i % contextSize]);
+	}
+	return divergence;
+}
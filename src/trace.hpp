@@ -0,0 +1,116 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// One executed instruction and the state it changed
+struct TraceRecord
+{
+	uint16_t pc{};
+	uint16_t opcode{};
+	uint16_t changedRegisters{}; // Bit n set if Vn changed
+	uint8_t registers[16]{};     // New values of the changed registers
+	bool indexChanged{};
+	uint16_t index{};
+};
+
+const unsigned int TRACE_BUFFER_SIZE = 1u << 16;
+
+// Streams trace records to a file. The emulation thread only copies
+// records into a single-producer single-consumer ring; a background
+// thread encodes them and writes them out, gzip-compressed if asked
+// and zlib is available.
+//
+// File format: "C8TR" then one entry per instruction:
+//   flags byte: bit 0 PC follows, bit 1 I follows, bit 2 registers follow
+//   opcode, 2 bytes big endian
+//   PC, if not the previous PC plus 2: zigzag varint delta from it
+//   I, if changed: zigzag varint delta from the previous I
+//   registers, if changed: 2-byte mask then one byte per set bit
+class TraceSink
+{
+public:
+	TraceSink(char const* filename, bool compress);
+	~TraceSink();
+	TraceSink(TraceSink const&) = delete;
+	TraceSink& operator=(TraceSink const&) = delete;
+
+	bool IsOpen() const { return file != nullptr; }
+
+	// Called from the emulation thread. Waits only when the writer
+	// has fallen a whole buffer behind, so no record is ever dropped.
+	void Push(TraceRecord const& record)
+	{
+		uint32_t position = head.load(std::memory_order_relaxed);
+		while (position - tail.load(std::memory_order_acquire) == TRACE_BUFFER_SIZE)
+		{
+			std::this_thread::yield();
+		}
+		records[position & (TRACE_BUFFER_SIZE - 1)] = record;
+		head.store(position + 1, std::memory_order_release);
+	}
+
+private:
+	void Run();
+	void Encode(TraceRecord const& record);
+	void Flush();
+
+	void* file{};
+	TraceRecord* records;
+	std::atomic<uint32_t> head{0};
+	std::atomic<uint32_t> tail{0};
+	std::atomic<bool> stopping{false};
+	std::thread writer;
+
+	// Writer thread only
+	uint16_t previousPc{};
+	uint16_t previousIndex{};
+	unsigned char output[1 << 16];
+	unsigned int outputSize{};
+};
+
+// Reads back files written by TraceSink, compressed or not
+class TraceReader
+{
+public:
+	explicit TraceReader(char const* filename);
+	~TraceReader();
+	TraceReader(TraceReader const&) = delete;
+	TraceReader& operator=(TraceReader const&) = delete;
+
+	bool IsOpen() const { return file != nullptr; }
+	// False at the end of the trace or on a truncated record
+	bool Next(TraceRecord& record);
+
+private:
+	int ReadByte();
+	bool ReadVarint(uint32_t& value);
+
+	void* file{};
+	uint16_t previousPc{};
+	uint16_t previousIndex{};
+};
+
+// Equal in everything the trace records
+bool SameRecord(TraceRecord const& a, TraceRecord const& b);
+
+// Where two traces part: the first step at which their records differ
+// or one of them has ended, and the records leading up to it
+struct TraceDivergence
+{
+	bool identical{};
+	// The differing step, or the length of identical traces
+	unsigned long step{};
+	// Whether each trace still had a record at that step
+	bool hasFirst{};
+	bool hasSecond{};
+	TraceRecord first;
+	TraceRecord second;
+	// Up to the requested number of records before it, oldest first
+	std::vector<TraceRecord> context;
+};
+
+// Read both traces in step until they part or both end
+TraceDivergence DiffTraces(TraceReader& first, TraceReader& second, unsigned int contextSize);
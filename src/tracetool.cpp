@@ -0,0 +1,147 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include "trace.hpp"
+
+static void PrintRecord(unsigned long step, TraceRecord const& record)
+{
+	std::printf("%10lu  %.3X  %.4X", step, record.pc, record.opcode);
+	if (record.indexChanged)
+	{
+		std::printf("  I=%.3X", record.index);
+	}
+	for (unsigned int i = 0; i < 16; ++i)
+	{
+		if (record.changedRegisters & (1u << i))
+		{
+			std::printf("  V%X=%.2X", i, record.registers[i]);
+		}
+	}
+	std::printf("\n");
+}
+
+static int Print(int argc, char** argv)
+{
+	char const* filename = nullptr;
+	unsigned long pcLow = 0;
+	unsigned long pcHigh = 0xFFFF;
+	unsigned long opcode = 0;
+	unsigned long opcodeMask = 0;
+	unsigned long limit = 0;
+
+	for (int i = 0; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--pc") == 0 && i + 1 < argc)
+		{
+			char* end = nullptr;
+			pcLow = std::strtoul(argv[++i], &end, 16);
+			pcHigh = *end == '-' ? std::strtoul(end + 1, nullptr, 16) : pcLow;
+		}
+		else if (std::strcmp(argv[i], "--opcode") == 0 && i + 1 < argc)
+		{
+			char* end = nullptr;
+			opcode = std::strtoul(argv[++i], &end, 16);
+			opcodeMask = *end == '/' ? std::strtoul(end + 1, nullptr, 16) : 0xFFFF;
+		}
+		else if (std::strcmp(argv[i], "--limit") == 0 && i + 1 < argc)
+		{
+			limit = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (filename == nullptr)
+		{
+			filename = argv[i];
+		}
+	}
+
+	TraceReader reader(filename != nullptr ? filename : "");
+	if (!reader.IsOpen())
+	{
+		std::cerr << "Cannot read trace " << (filename != nullptr ? filename : "") << "\n";
+		return EXIT_FAILURE;
+	}
+
+	TraceRecord record;
+	unsigned long printed = 0;
+
+	for (unsigned long step = 0; reader.Next(record); ++step)
+	{
+		if (record.pc < pcLow || record.pc > pcHigh || (record.opcode & opcodeMask) != opcode)
+		{
+			continue;
+		}
+
+		PrintRecord(step, record);
+		if (++printed == limit)
+		{
+			break;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int Diff(char const* first, char const* second)
+{
+	TraceReader a(first);
+	TraceReader b(second);
+	if (!a.IsOpen() || !b.IsOpen())
+	{
+		std::cerr << "Cannot read trace " << (a.IsOpen() ? second : first) << "\n";
+		return EXIT_FAILURE;
+	}
+
+	// Keep a little history to show how the traces got there
+	const unsigned int CONTEXT = 4;
+	TraceDivergence divergence = DiffTraces(a, b, CONTEXT);
+	if (divergence.identical)
+	{
+		std::printf("Traces are identical (%lu instructions)\n", divergence.step);
+		return EXIT_SUCCESS;
+	}
+
+	std::printf("Traces diverge at instruction %lu\n", divergence.step);
+	unsigned long step = divergence.step - divergence.context.size();
+	for (TraceRecord const& record : divergence.context)
+	{
+		PrintRecord(step++, record);
+	}
+
+	if (divergence.hasFirst)
+	{
+		std::printf("%s:\n", first);
+		PrintRecord(divergence.step, divergence.first);
+	}
+	else
+	{
+		std::printf("%s ends here\n", first);
+	}
+
+	if (divergence.hasSecond)
+	{
+		std::printf("%s:\n", second);
+		PrintRecord(divergence.step, divergence.second);
+	}
+	else
+	{
+		std::printf("%s ends here\n", second);
+	}
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 3 && std::strcmp(argv[1], "print") == 0)
+	{
+		return Print(argc - 2, argv + 2);
+	}
+
+	if (argc == 4 && std::strcmp(argv[1], "diff") == 0)
+	{
+		return Diff(argv[2], argv[3]);
+	}
+
+	std::cerr << "Usage: " << argv[0] << " print <trace> [--pc <from>[-<to>]] [--opcode <hex>[/<mask>]] [--limit <n>]\n"
+		<< "       " << argv[0] << " diff <trace> <trace>\n";
+	return EXIT_FAILURE;
+}
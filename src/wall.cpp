@@ -0,0 +1,135 @@
+#include "wall.hpp"
+#include <algorithm>
+#include <cstring>
+
+SessionWall::SessionWall(unsigned int count, unsigned int threads)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		sessions.emplace_back(new WallSession());
+	}
+
+	// Tiles are twice as wide as they are high, so a square grid keeps
+	// the window at the 2:1 of a single session
+	while (columns * columns < count)
+	{
+		++columns;
+	}
+	rows = columns != 0 ? (count + columns - 1) / columns : 0;
+	atlas.assign(AtlasWidth() * AtlasHeight(), 0);
+
+	for (unsigned int worker = 1; worker < threads; ++worker)
+	{
+		workers.emplace_back(&SessionWall::Work, this);
+	}
+}
+
+SessionWall::~SessionWall()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+void SessionWall::SetTiming(unsigned int session, unsigned int instructionsPerFrame, unsigned int cycleBudget)
+{
+	sessions[session]->scheduler = FrameScheduler(instructionsPerFrame, cycleBudget);
+}
+
+int SessionWall::SessionAt(unsigned int x, unsigned int y) const
+{
+	if (x >= AtlasWidth() || y >= AtlasHeight())
+	{
+		return -1;
+	}
+	unsigned int session = y / DISPLAY_HEIGHT * columns + x / DISPLAY_WIDTH;
+	return session < sessions.size() ? static_cast<int>(session) : -1;
+}
+
+void SessionWall::RunFrame(unsigned int& firstRow, unsigned int& endRow)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		next = 0;
+		busyWorkers = workers.size();
+		++generation;
+	}
+	wake.notify_all();
+
+	for (unsigned int session = next++; session < sessions.size(); session = next++)
+	{
+		RunSession(session);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return busyWorkers == 0; });
+	}
+
+	firstRow = AtlasHeight();
+	endRow = 0;
+	for (unsigned int session = 0; session < sessions.size(); ++session)
+	{
+		uint32_t dirtyRows = sessions[session]->dirtyRows;
+		if (dirtyRows != 0)
+		{
+			firstRow = std::min(firstRow, TileY(session) + __builtin_ctz(dirtyRows));
+			endRow = std::max(endRow, TileY(session) + DISPLAY_HEIGHT - __builtin_clz(dirtyRows));
+		}
+	}
+	firstRow = std::min(firstRow, endRow);
+}
+
+void SessionWall::Work()
+{
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;)
+	{
+		wake.wait(lock, [&] { return stopping || generation != seen; });
+		if (stopping)
+		{
+			return;
+		}
+		seen = generation;
+		lock.unlock();
+
+		for (unsigned int session = next++; session < sessions.size(); session = next++)
+		{
+			RunSession(session);
+		}
+
+		lock.lock();
+		if (--busyWorkers == 0)
+		{
+			done.notify_one();
+		}
+	}
+}
+
+void SessionWall::RunSession(unsigned int session)
+{
+	WallSession& wallSession = *sessions[session];
+	Chip8& chip8 = wallSession.chip8;
+	if (chip8.GetTrap() == Trap::None)
+	{
+		wallSession.scheduler.RunFrame(chip8);
+	}
+
+	// Tiles do not overlap, so workers copy into the atlas without a lock
+	wallSession.dirtyRows = chip8.TakeDirtyRows();
+	uint32_t* tile = &atlas[TileY(session) * AtlasWidth() + TileX(session)];
+	for (unsigned int row = 0; row < DISPLAY_HEIGHT; ++row)
+	{
+		if (wallSession.dirtyRows & (1u << row))
+		{
+			std::memcpy(tile + row * AtlasWidth(), chip8.display + row * DISPLAY_WIDTH, DISPLAY_WIDTH * sizeof(uint32_t));
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "chip8.hpp"
+#include "timing.hpp"
+
+// Many sessions in one process, for a wall of games on one screen.
+// Each frame, worker threads run every session and copy the rows it
+// changed into its tile of one shared atlas, which the host then uploads
+// and presents once. Sessions are laid out in a near-square grid.
+class SessionWall
+{
+public:
+	// Threads includes the calling thread, which works too
+	SessionWall(unsigned int sessions, unsigned int threads);
+	~SessionWall();
+	SessionWall(SessionWall const&) = delete;
+	SessionWall& operator=(SessionWall const&) = delete;
+
+	unsigned int Sessions() const { return sessions.size(); }
+	Chip8& Session(unsigned int session) { return sessions[session]->chip8; }
+	// Timing as for FrameScheduler
+	void SetTiming(unsigned int session, unsigned int instructionsPerFrame, unsigned int cycleBudget);
+
+	// Run one frame of every session that has not trapped, and update
+	// the atlas. Returns the atlas rows changed, as [first, end).
+	void RunFrame(unsigned int& firstRow, unsigned int& endRow);
+
+	uint32_t const* Atlas() const { return atlas.data(); }
+	unsigned int AtlasWidth() const { return columns * DISPLAY_WIDTH; }
+	unsigned int AtlasHeight() const { return rows * DISPLAY_HEIGHT; }
+	int AtlasPitch() const { return AtlasWidth() * sizeof(uint32_t); }
+
+	// Top left corner of a session's tile in the atlas
+	unsigned int TileX(unsigned int session) const { return session % columns * DISPLAY_WIDTH; }
+	unsigned int TileY(unsigned int session) const { return session / columns * DISPLAY_HEIGHT; }
+	// The session shown at an atlas position, or -1 for none
+	int SessionAt(unsigned int x, unsigned int y) const;
+
+private:
+	struct WallSession
+	{
+		Chip8 chip8;
+		FrameScheduler scheduler{DEFAULT_CYCLES_PER_FRAME, 0};
+		// Display rows the last frame changed
+		uint32_t dirtyRows{};
+	};
+
+	void Work();
+	void RunSession(unsigned int session);
+
+	std::vector<std::unique_ptr<WallSession>> sessions;
+	unsigned int columns{};
+	unsigned int rows{};
+	std::vector<uint32_t> atlas;
+
+	// Every frame bumps the generation to wake the workers, which take
+	// sessions from next until none are left
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	uint64_t generation{};
+	unsigned int busyWorkers{};
+	bool stopping{};
+	std::atomic<unsigned int> next{0};
+};
@@ -0,0 +1,399 @@
+#include "workload.hpp"
+#include <cstdio>
+#include <cstring>
+
+const unsigned int START_ADDRESS = 0x200;
+
+// Outer loop counter, left alone by every workload body
+const unsigned int COUNTER_REGISTER = 0xE;
+
+// Emits instructions from START_ADDRESS, with labels for addresses that
+// are only known once everything is laid out
+class Assembler
+{
+public:
+	unsigned int NewLabel()
+	{
+		labels.push_back(0);
+		return labels.size() - 1;
+	}
+
+	void Bind(unsigned int label) { labels[label] = Here(); }
+	uint16_t Address(unsigned int label) const { return labels[label]; }
+	uint16_t Here() const { return START_ADDRESS + bytes.size(); }
+
+	void Emit(uint16_t opcode)
+	{
+		bytes.push_back(opcode >> 8);
+		bytes.push_back(opcode & 0xFF);
+	}
+
+	// An instruction whose low 12 bits are filled in with the label's
+	// address plus the offset
+	void Emit(uint16_t opcode, unsigned int label, unsigned int offset = 0)
+	{
+		fixups.push_back(Fixup{ bytes.size(), label, offset });
+		Emit(opcode);
+	}
+
+	void Byte(uint8_t value) { bytes.push_back(value); }
+
+	std::vector<uint8_t> Finish()
+	{
+		for (Fixup const& fixup : fixups)
+		{
+			uint16_t address = (labels[fixup.label] + fixup.offset) & ADDRESS_MASK;
+			bytes[fixup.position] |= address >> 8;
+			bytes[fixup.position + 1] = address & 0xFF;
+		}
+		return bytes;
+	}
+
+private:
+	struct Fixup
+	{
+		size_t position;
+		unsigned int label;
+		unsigned int offset;
+	};
+
+	std::vector<uint8_t> bytes;
+	std::vector<uint16_t> labels;
+	std::vector<Fixup> fixups;
+};
+
+static unsigned int MaximumSize(Workload workload)
+{
+	switch (workload)
+	{
+		case Workload::Sprites: return 15;
+		case Workload::Calls: return STACK_LEVELS;
+		case Workload::BlockMove: return COUNTER_REGISTER;
+		case Workload::SelfModify: return 16;
+		case Workload::Skips: return 240;
+		default: return 0;
+	}
+}
+
+bool ParseWorkload(char const* name, Workload& workload)
+{
+	for (unsigned int i = 0; i < static_cast<unsigned int>(Workload::Count); ++i)
+	{
+		if (std::strcmp(name, WorkloadName(static_cast<Workload>(i))) == 0)
+		{
+			workload = static_cast<Workload>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+char const* WorkloadName(Workload workload)
+{
+	switch (workload)
+	{
+		case Workload::Sprites: return "sprites";
+		case Workload::Calls: return "calls";
+		case Workload::BlockMove: return "blockmove";
+		case Workload::SelfModify: return "selfmodify";
+		case Workload::Skips: return "skips";
+		default: return "unknown";
+	}
+}
+
+// Each body below emits one iteration of the outer loop, returns the
+// instructions it runs, and fills in the state it leaves behind
+
+// 16 sprites of 8 by size pixels tile the screen, XORed on and off by
+// alternate iterations
+static uint64_t SpritesBody(Assembler& code, unsigned int sprite, unsigned int size, unsigned int iterations,
+	WorkloadRom& rom)
+{
+	uint64_t instructions = 0;
+	for (unsigned int y = 0; y < DISPLAY_HEIGHT; y += 16)
+	{
+		for (unsigned int x = 0; x < DISPLAY_WIDTH; x += 8)
+		{
+			code.Emit(0x6000 | x);
+			code.Emit(0x6100 | y);
+			code.Emit(0xA000, sprite);
+			code.Emit(0xD010 | size);
+			instructions += 4;
+		}
+	}
+
+	rom.registers[0] = DISPLAY_WIDTH - 8;
+	rom.registers[1] = 16;
+	// Even iterations erase what the one before drew
+	rom.registers[0xF] = iterations % 2 == 0 ? 1 : 0;
+	rom.litPixels = iterations % 2 == 0 ? 0 : 16 * 8 * size;
+	return instructions;
+}
+
+// A chain of size subroutines, each adding one to V0 and calling the next
+static uint64_t CallsBody(Assembler& code, std::vector<unsigned int> const& subroutines, unsigned int iterations,
+	WorkloadRom& rom)
+{
+	code.Emit(0x2000, subroutines[0]);
+	rom.registers[0] = iterations * subroutines.size();
+	return 3 * subroutines.size();
+}
+
+static void CallsSubroutines(Assembler& code, std::vector<unsigned int> const& subroutines)
+{
+	for (size_t i = 0; i < subroutines.size(); ++i)
+	{
+		code.Bind(subroutines[i]);
+		code.Emit(0x7001);
+		if (i + 1 < subroutines.size())
+		{
+			code.Emit(0x2000, subroutines[i + 1]);
+		}
+		code.Emit(0x00EE);
+	}
+}
+
+// Load a block, bump its first byte, and store it back and to a copy.
+// I is set before every move, so the index quirk does not matter.
+static uint64_t BlockMoveBody(Assembler& code, unsigned int source, unsigned int copy, unsigned int size,
+	unsigned int iterations, WorkloadRom& rom)
+{
+	uint16_t last = (size - 1) << 8;
+	code.Emit(0xA000, source);
+	code.Emit(0xF065 | last);
+	code.Emit(0x7001);
+	code.Emit(0xA000, source);
+	code.Emit(0xF055 | last);
+	code.Emit(0xA000, copy);
+	code.Emit(0xF055 | last);
+
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		rom.registers[i] = 0x10 + i + (i == 0 ? iterations : 0);
+	}
+	return 7;
+}
+
+// Each site loads an immediate, adds one and writes it back over the
+// immediate. The load is paired with another, so RunFrame decodes it as
+// one fused step that every write must invalidate.
+static uint64_t SelfModifyBody(Assembler& code, std::vector<unsigned int> const& sites, unsigned int iterations,
+	WorkloadRom& rom)
+{
+	for (size_t i = 0; i < sites.size(); ++i)
+	{
+		code.Bind(sites[i]);
+		code.Emit(0x6000 | (i * 0x10));
+		code.Emit(0x6100);
+		code.Emit(0x7001);
+		code.Emit(0xA000, sites[i], 1);
+		code.Emit(0xF055);
+	}
+
+	rom.registers[0] = (sites.size() - 1) * 0x10 + iterations;
+	return 5 * sites.size();
+}
+
+// Skips of every kind, taken or not, each over an add to V2 or V3. Only
+// the adds to V3 run. Assumes no key is held.
+static uint64_t SkipsBody(Assembler& code, unsigned int size, unsigned int iterations, WorkloadRom& rom)
+{
+	static struct { uint16_t opcode; bool taken; } const skips[] =
+	{
+		{ 0x3000, true },  // SE V0, 0
+		{ 0x4000, false }, // SNE V0, 0
+		{ 0x5010, false }, // SE V0, V1
+		{ 0x9010, true },  // SNE V0, V1
+		{ 0xE09E, false }, // SKP V0
+		{ 0xE0A1, true },  // SKNP V0
+	};
+
+	uint64_t instructions = 0;
+	unsigned int adds = 0;
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		auto const& skip = skips[i % (sizeof(skips) / sizeof(skips[0]))];
+		code.Emit(skip.opcode);
+		code.Emit(skip.taken ? 0x7201 : 0x7301);
+		instructions += skip.taken ? 1 : 2;
+		adds += skip.taken ? 0 : 1;
+	}
+
+	rom.registers[1] = 1;
+	rom.registers[3] = iterations * adds;
+	return instructions;
+}
+
+bool GenerateWorkload(Workload workload, WorkloadOptions const& options, WorkloadRom& rom)
+{
+	unsigned int size = options.size != 0 ? options.size : MaximumSize(workload);
+	if (size > MaximumSize(workload) || options.iterations < 1 || options.iterations > 255)
+	{
+		return false;
+	}
+
+	rom = WorkloadRom();
+	Assembler code;
+	unsigned int start = code.NewLabel();
+	unsigned int loop = code.NewLabel();
+	unsigned int halt = code.NewLabel();
+	unsigned int data = code.NewLabel();
+	code.Bind(start);
+
+	// Set up the registers a pass relies on, so that a looping ROM
+	// starts every pass the same way
+	uint64_t setup = 1;
+	if (workload == Workload::Skips)
+	{
+		code.Emit(0x6000);
+		code.Emit(0x6101);
+		setup += 2;
+	}
+	code.Emit(0x6000 | COUNTER_REGISTER << 8 | options.iterations);
+	code.Bind(loop);
+
+	uint64_t body = 0;
+	std::vector<unsigned int> labels;
+	switch (workload)
+	{
+		case Workload::Sprites:
+			body = SpritesBody(code, data, size, options.iterations, rom);
+			break;
+
+		case Workload::Calls:
+			for (unsigned int i = 0; i < size; ++i)
+			{
+				labels.push_back(code.NewLabel());
+			}
+			body = CallsBody(code, labels, options.iterations, rom);
+			break;
+
+		case Workload::BlockMove:
+			labels.push_back(code.NewLabel());
+			body = BlockMoveBody(code, data, labels[0], size, options.iterations, rom);
+			break;
+
+		case Workload::SelfModify:
+			for (unsigned int i = 0; i < size; ++i)
+			{
+				labels.push_back(code.NewLabel());
+			}
+			body = SelfModifyBody(code, labels, options.iterations, rom);
+			break;
+
+		case Workload::Skips:
+			body = SkipsBody(code, size, options.iterations, rom);
+			break;
+
+		default:
+			return false;
+	}
+
+	// A counted loop, then I is set so that it does not depend on the
+	// index quirk
+	code.Emit(0x7000 | COUNTER_REGISTER << 8 | 0xFF);
+	code.Emit(0x3000 | COUNTER_REGISTER << 8);
+	code.Emit(0x1000, loop);
+	code.Emit(0xA000, data);
+	code.Bind(halt);
+	code.Emit(0x1000, options.loop ? start : halt);
+
+	if (workload == Workload::Calls)
+	{
+		CallsSubroutines(code, labels);
+	}
+
+	code.Bind(data);
+	switch (workload)
+	{
+		case Workload::Sprites:
+			for (unsigned int i = 0; i < size; ++i)
+			{
+				code.Byte(0xFF);
+			}
+			break;
+
+		case Workload::BlockMove:
+			for (unsigned int i = 0; i < size; ++i)
+			{
+				code.Byte(0x10 + i);
+				rom.memory.push_back(std::make_pair(code.Address(data) + i, rom.registers[i]));
+			}
+			code.Bind(labels[0]);
+			for (unsigned int i = 0; i < size; ++i)
+			{
+				code.Byte(0);
+				rom.memory.push_back(std::make_pair(code.Address(labels[0]) + i, rom.registers[i]));
+			}
+			break;
+
+		default:
+			break;
+	}
+
+	rom.data = code.Finish();
+	if (workload == Workload::SelfModify)
+	{
+		for (unsigned int i = 0; i < size; ++i)
+		{
+			rom.memory.push_back(std::make_pair(code.Address(labels[i]) + 1, static_cast<uint8_t>(i * 0x10 + options.iterations)));
+		}
+	}
+
+	// The last pass runs the ANNN in place of the jump back
+	rom.haltAddress = code.Address(halt);
+	rom.instructions = setup + options.iterations * (body + 3);
+	rom.index = code.Address(data);
+	return true;
+}
+
+bool CheckWorkload(Chip8 const& chip8, WorkloadRom const& rom)
+{
+	Chip8Core const& state = chip8.GetState();
+	bool matches = true;
+
+	if (chip8.GetTrap() != Trap::None)
+	{
+		std::fprintf(stderr, "Trap: %s at %.3X\n", TrapName(chip8.GetTrap()), chip8.GetTrapAddress());
+		matches = false;
+	}
+	if (state.programCounter != rom.haltAddress)
+	{
+		std::fprintf(stderr, "PC is %.3X, expected %.3X\n", state.programCounter, rom.haltAddress);
+		matches = false;
+	}
+	for (unsigned int i = 0; i < REGISTER_COUNT; ++i)
+	{
+		if (state.registers[i] != rom.registers[i])
+		{
+			std::fprintf(stderr, "V%X is %.2X, expected %.2X\n", i, state.registers[i], rom.registers[i]);
+			matches = false;
+		}
+	}
+	if (state.index != rom.index)
+	{
+		std::fprintf(stderr, "I is %.3X, expected %.3X\n", state.index, rom.index);
+		matches = false;
+	}
+	for (auto const& byte : rom.memory)
+	{
+		if (chip8.ReadMemory(byte.first) != byte.second)
+		{
+			std::fprintf(stderr, "Memory at %.3X is %.2X, expected %.2X\n", byte.first, chip8.ReadMemory(byte.first),
+				byte.second);
+			matches = false;
+		}
+	}
+
+	unsigned int litPixels = 0;
+	for (uint32_t pixel : chip8.display)
+	{
+		litPixels += pixel != 0 ? 1 : 0;
+	}
+	if (litPixels != rom.litPixels)
+	{
+		std::fprintf(stderr, "%u pixels are lit, expected %u\n", litPixels, rom.litPixels);
+		matches = false;
+	}
+	return matches;
+}
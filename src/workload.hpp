@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "chip8.hpp"
+
+// Synthetic ROMs that each stress one kind of work, for benchmarks and
+// conformance runs. Each runs an outer loop a given number of times and
+// then halts on a jump to itself, in an end state known in advance. The
+// ROMs avoid every instruction whose behavior depends on the quirk
+// profile, so the end state is the same under all of them.
+enum class Workload
+{
+	Sprites,    // Full-screen DXYN traffic
+	Calls,      // CALL/RET chains nested up to STACK_LEVELS deep
+	BlockMove,  // FX65 and FX55 moving blocks of registers
+	SelfModify, // Code that patches its own immediates before running them
+	Skips,      // Dense chains of every skip instruction
+	Count
+};
+
+bool ParseWorkload(char const* name, Workload& workload);
+char const* WorkloadName(Workload workload);
+
+struct WorkloadOptions
+{
+	// Outer loop count, from 1 to 255
+	unsigned int iterations = 100;
+	// Sprite height, call depth, registers per block move, patched
+	// instructions or skips per iteration. Zero picks the largest.
+	unsigned int size = 0;
+	// Jump back to the start instead of halting, for benchmarks. The
+	// expected state then only holds after the first pass.
+	bool loop = false;
+};
+
+struct WorkloadRom
+{
+	std::vector<uint8_t> data;
+	// Address of the final jump, and the instructions run to first reach it
+	uint16_t haltAddress{};
+	uint64_t instructions{};
+	// Expected state at that point
+	uint8_t registers[REGISTER_COUNT]{};
+	uint16_t index{};
+	std::vector<std::pair<uint16_t, uint8_t>> memory;
+	unsigned int litPixels{};
+};
+
+// Returns false if the options are out of range for the workload
+bool GenerateWorkload(Workload workload, WorkloadOptions const& options, WorkloadRom& rom);
+
+// Compares a machine stopped at the halt with the expected state, and
+// prints every difference to stderr
+bool CheckWorkload(Chip8 const& chip8, WorkloadRom const& rom);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdio>
+
+// Minimal assertions for the test programs. A failed check prints where
+// it failed and is counted; each test program returns nonzero if any
+// check failed.
+inline unsigned int& CheckFailures()
+{
+	static unsigned int failures = 0;
+	return failures;
+}
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			++CheckFailures(); \
+		} \
+	} while (0)
+
+#define CHECK_EQUAL(actual, expected) \
+	do \
+	{ \
+		unsigned long long actualValue = (actual); \
+		unsigned long long expectedValue = (expected); \
+		if (actualValue != expectedValue) \
+		{ \
+			std::fprintf(stderr, "%s:%d: %s is 0x%llX, expected 0x%llX\n", __FILE__, __LINE__, #actual, \
+				actualValue, expectedValue); \
+			++CheckFailures(); \
+		} \
+	} while (0)
+
+// Run one test function, naming it if it failed
+#define RUN_TEST(test) \
+	do \
+	{ \
+		unsigned int failuresBefore = CheckFailures(); \
+		test(); \
+		if (CheckFailures() != failuresBefore) \
+		{ \
+			std::fprintf(stderr, "FAILED %s\n", #test); \
+		} \
+	} while (0)
@@ -0,0 +1,921 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../src/chip8.hpp"
+#include "../src/debugger.hpp"
+#include "../src/pool.hpp"
+#include "../src/romdb.hpp"
+#include "../src/rompack.hpp"
+#include "../src/timing.hpp"
+#include "../src/trace.hpp"
+#include "../src/wall.hpp"
+#include "../src/workload.hpp"
+#include "check.hpp"
+
+// Test ROMs. Each loops forever, so any frame count can be checked.
+
+// ALU flags, BCD and FX55/FX65, printing a running checksum
+static uint8_t const ALU_ROM[] = {
+	0x6D, 0x00,              // 200 LD VD, 00
+	0x6C, 0x00,              // 202 LD VC, 00
+	0x80, 0xD0,              // 204 loop: LD V0, VD
+	0x81, 0xC0,              // 206 LD V1, VC
+	0x80, 0x14,              // 208 ADD V0, V1
+	0x8C, 0xF4,              // 20A ADD VC, VF
+	0x80, 0x15,              // 20C SUB V0, V1
+	0x8C, 0xF4,              // 20E ADD VC, VF
+	0x81, 0x07,              // 210 SUBN V1, V0
+	0x8C, 0xF4,              // 212 ADD VC, VF
+	0x80, 0x16,              // 214 SHR V0, V1
+	0x8C, 0xF4,              // 216 ADD VC, VF
+	0x81, 0x0E,              // 218 SHL V1, V0
+	0x8C, 0x13,              // 21A XOR VC, V1
+	0x82, 0x01,              // 21C OR V2, V0
+	0x82, 0xD2,              // 21E AND V2, VD
+	0x8C, 0x24,              // 220 ADD VC, V2
+	0x8C, 0xF4,              // 222 ADD VC, VF
+	0x8F, 0x05,              // 224 SUB VF, V0
+	0x8C, 0xF4,              // 226 ADD VC, VF
+	0xA2, 0x4A,              // 228 LD I, buffer
+	0xF3, 0x55,              // 22A LD [I], V3
+	0xFC, 0x33,              // 22C LD B, VC
+	0xF2, 0x65,              // 22E LD V2, [I]
+	0x00, 0xE0,              // 230 CLS
+	0x65, 0x08,              // 232 LD V5, 08
+	0x66, 0x08,              // 234 LD V6, 08
+	0xF0, 0x29,              // 236 LD F, V0
+	0xD5, 0x65,              // 238 DRW V5, V6, 5
+	0x75, 0x05,              // 23A ADD V5, 05
+	0xF1, 0x29,              // 23C LD F, V1
+	0xD5, 0x65,              // 23E DRW V5, V6, 5
+	0x75, 0x05,              // 240 ADD V5, 05
+	0xF2, 0x29,              // 242 LD F, V2
+	0xD5, 0x65,              // 244 DRW V5, V6, 5
+	0x7D, 0x03,              // 246 ADD VD, 03
+	0x12, 0x04,              // 248 JP loop
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 24A buffer:
+};
+
+// Sprites walking off the edges, random font digits and delay timer waits
+static uint8_t const SPRITES_ROM[] = {
+	0x60, 0x00,              // 200 LD V0, 00
+	0x61, 0x00,              // 202 LD V1, 00
+	0x68, 0x00,              // 204 LD V8, 00
+	0x67, 0x00,              // 206 LD V7, 00
+	0xA2, 0x2E,              // 208 loop: LD I, ship
+	0xD0, 0x16,              // 20A DRW V0, V1, 6
+	0x88, 0xF4,              // 20C ADD V8, VF
+	0x70, 0x03,              // 20E ADD V0, 03
+	0x71, 0x01,              // 210 ADD V1, 01
+	0xC4, 0x0F,              // 212 RND V4, 0F
+	0xF4, 0x29,              // 214 LD F, V4
+	0xD4, 0x15,              // 216 DRW V4, V1, 5
+	0x65, 0x02,              // 218 LD V5, 02
+	0xF5, 0x15,              // 21A LD DT, V5
+	0xF6, 0x07,              // 21C wait: LD V6, DT
+	0x36, 0x00,              // 21E SE V6, 00
+	0x12, 0x1C,              // 220 JP wait
+	0x77, 0x01,              // 222 ADD V7, 01
+	0x37, 0x40,              // 224 SE V7, 40
+	0x12, 0x08,              // 226 JP loop
+	0x00, 0xE0,              // 228 CLS
+	0x67, 0x00,              // 22A LD V7, 00
+	0x12, 0x08,              // 22C JP loop
+	0x18, 0x3C, 0x7E, 0xFF, 0x5A, 0x81, // 22E ship:
+};
+
+// A dot moved by keys 2, 4, 6 and 8, with FX0A waits and the sound timer
+static uint8_t const KEYS_ROM[] = {
+	0x60, 0x14,              // 200 LD V0, 14
+	0x61, 0x0A,              // 202 LD V1, 0A
+	0xA2, 0x40,              // 204 LD I, dot
+	0xD0, 0x11,              // 206 DRW V0, V1, 1
+	0xF2, 0x0A,              // 208 LD V2, K
+	0x63, 0x04,              // 20A loop: LD V3, 04
+	0xE3, 0xA1,              // 20C SKNP V3
+	0x70, 0xFF,              // 20E ADD V0, FF
+	0x63, 0x06,              // 210 LD V3, 06
+	0xE3, 0xA1,              // 212 SKNP V3
+	0x70, 0x01,              // 214 ADD V0, 01
+	0x63, 0x02,              // 216 LD V3, 02
+	0xE3, 0xA1,              // 218 SKNP V3
+	0x71, 0xFF,              // 21A ADD V1, FF
+	0x63, 0x08,              // 21C LD V3, 08
+	0xE3, 0x9E,              // 21E SKP V3
+	0x12, 0x24,              // 220 JP draw
+	0x71, 0x01,              // 222 ADD V1, 01
+	0xA2, 0x40,              // 224 draw: LD I, dot
+	0xD0, 0x11,              // 226 DRW V0, V1, 1
+	0x64, 0x01,              // 228 LD V4, 01
+	0xF4, 0x15,              // 22A LD DT, V4
+	0xF5, 0x07,              // 22C wait: LD V5, DT
+	0x35, 0x00,              // 22E SE V5, 00
+	0x12, 0x2C,              // 230 JP wait
+	0x63, 0x00,              // 232 LD V3, 00
+	0xE3, 0x9E,              // 234 SKP V3
+	0x12, 0x0A,              // 236 JP loop
+	0x64, 0x04,              // 238 LD V4, 04
+	0xF4, 0x18,              // 23A LD ST, V4
+	0xF6, 0x0A,              // 23C LD V6, K
+	0x12, 0x0A,              // 23E JP loop
+	0x80,                    // 240 dot:
+};
+
+// Nested calls, a BNNN jump table, a counted delay loop and code that
+// patches a fused instruction pair
+static uint8_t const CALLS_ROM[] = {
+	0x6A, 0x00,              // 200 LD VA, 00
+	0x22, 0x5C,              // 202 loop: CALL sub1
+	0x80, 0xA0,              // 204 LD V0, VA
+	0x61, 0x03,              // 206 LD V1, 03
+	0x80, 0x12,              // 208 AND V0, V1
+	0x80, 0x04,              // 20A ADD V0, V0
+	0x82, 0x00,              // 20C LD V2, V0
+	0xB2, 0x10,              // 20E JP V0, table
+	0x12, 0x18,              // 210 table: JP case0
+	0x12, 0x1C,              // 212 JP case1
+	0x12, 0x20,              // 214 JP case2
+	0x12, 0x24,              // 216 JP case3
+	0x7B, 0x01,              // 218 case0: ADD VB, 01
+	0x12, 0x2C,              // 21A JP patch
+	0x7B, 0x03,              // 21C case1: ADD VB, 03
+	0x12, 0x2C,              // 21E JP patch
+	0x22, 0x64,              // 220 case2: CALL deep3
+	0x12, 0x2C,              // 222 JP patch
+	0xA2, 0x2C,              // 224 case3: LD I, patch
+	0x60, 0x7C,              // 226 LD V0, 7C
+	0x81, 0xA0,              // 228 LD V1, VA
+	0xF1, 0x55,              // 22A LD [I], V1
+	0x6C, 0x00,              // 22C patch: LD VC, 00
+	0x68, 0x05,              // 22E LD V8, 05
+	0x69, 0x00,              // 230 LD V9, 00
+	0x79, 0x04,              // 232 delay: ADD V9, 04
+	0x39, 0x00,              // 234 SE V9, 00
+	0x12, 0x32,              // 236 JP delay
+	0x7A, 0x01,              // 238 ADD VA, 01
+	0x00, 0xE0,              // 23A CLS
+	0xA2, 0x70,              // 23C LD I, buffer
+	0xFC, 0x33,              // 23E LD B, VC
+	0xF2, 0x65,              // 240 LD V2, [I]
+	0x63, 0x00,              // 242 LD V3, 00
+	0x64, 0x00,              // 244 LD V4, 00
+	0xF0, 0x29,              // 246 LD F, V0
+	0xD3, 0x45,              // 248 DRW V3, V4, 5
+	0x73, 0x05,              // 24A ADD V3, 05
+	0xF1, 0x29,              // 24C LD F, V1
+	0xD3, 0x45,              // 24E DRW V3, V4, 5
+	0x73, 0x05,              // 250 ADD V3, 05
+	0xF2, 0x29,              // 252 LD F, V2
+	0xD3, 0x45,              // 254 DRW V3, V4, 5
+	0xFB, 0x29,              // 256 LD F, VB
+	0xD8, 0x45,              // 258 DRW V8, V4, 5
+	0x12, 0x02,              // 25A JP loop
+	0x22, 0x60,              // 25C sub1: CALL sub2
+	0x00, 0xEE,              // 25E RET
+	0x7D, 0x01,              // 260 sub2: ADD VD, 01
+	0x00, 0xEE,              // 262 RET
+	0x22, 0x68,              // 264 deep3: CALL deep2
+	0x00, 0xEE,              // 266 RET
+	0x22, 0x6C,              // 268 deep2: CALL deep1
+	0x00, 0xEE,              // 26A RET
+	0x7E, 0x07,              // 26C deep1: ADD VE, 07
+	0x00, 0xEE,              // 26E RET
+	0x00, 0x00, 0x00,        // 270 buffer:
+};
+
+// Hold these keys, one bit per key, from the given frame on
+struct KeyEvent
+{
+	unsigned int frame;
+	uint16_t keys;
+};
+
+// Expected hashes after the given number of frames
+struct Checkpoint
+{
+	unsigned int frame;
+	uint64_t display;
+	uint64_t machine;
+};
+
+struct TestRom
+{
+	char const* name;
+	uint8_t const* data;
+	size_t size;
+	QuirkProfile profile;
+	unsigned int cyclesPerFrame;
+	std::vector<KeyEvent> keys;
+	std::vector<Checkpoint> checkpoints;
+};
+
+// Regenerate the hashes with --print after a deliberate behavior change
+static std::vector<TestRom> const TEST_ROMS = {
+	{
+		"alu vip", ALU_ROM, sizeof(ALU_ROM), QuirkProfile::CosmacVip, 23,
+		{},
+		{
+			{ 1, 0xB9D103FD6854A325ull, 0xF4A7F94F45859EA5ull },
+			{ 10, 0xA7C434FDFE09C445ull, 0x4B9459EAE1B8C66Full },
+			{ 60, 0x1BA5C7FA68CE3074ull, 0x882A0156F753BC56ull },
+			{ 150, 0xAB76EF50AE35D9E4ull, 0x430C471AC032E8ABull },
+			{ 300, 0xB1F71413B3473315ull, 0x40A43FE49D8E5BF6ull },
+		}
+	},
+	{
+		"alu schip", ALU_ROM, sizeof(ALU_ROM), QuirkProfile::SuperChip, 23,
+		{},
+		{
+			{ 1, 0xB9D103FD6854A325ull, 0xB870B5EC965E7719ull },
+			{ 10, 0xDA95870F275427D4ull, 0xD81D0D731406B53Eull },
+			{ 60, 0x976312AFCDD6FCD4ull, 0xF826802A6EA0686Dull },
+			{ 150, 0x828BC4462059AE75ull, 0xDA1DFBF86214CCC2ull },
+			{ 300, 0xD1C87496DCBE52B4ull, 0x3E75DF0064C3B116ull },
+		}
+	},
+	{
+		"sprites schip", SPRITES_ROM, sizeof(SPRITES_ROM), QuirkProfile::SuperChip, 15,
+		{},
+		{
+			{ 1, 0x96075B61023CB8E5ull, 0xF428D80951BF35E6ull },
+			{ 10, 0xF874D6E9A1E5F0D4ull, 0xA279E6A442CF51F0ull },
+			{ 60, 0xFD851D1BF86CF144ull, 0x04E13CBF3F5849A0ull },
+			{ 150, 0xDEC6D48C6B266E15ull, 0x98202B243D4BC482ull },
+			{ 300, 0x96BE2300F14CEA24ull, 0xF9A9168B32909A11ull },
+		}
+	},
+	{
+		"sprites modern", SPRITES_ROM, sizeof(SPRITES_ROM), QuirkProfile::Modern, 15,
+		{},
+		{
+			{ 1, 0x96075B61023CB8E5ull, 0xF428D80951BF35E6ull },
+			{ 10, 0xF874D6E9A1E5F0D4ull, 0xA279E6A442CF51F0ull },
+			{ 60, 0xA45E1B6DCBC758F5ull, 0x04E13CBF3F5849A0ull },
+			{ 150, 0x7A7A799964A6CFF4ull, 0x56CC706C64FB4EB8ull },
+			{ 300, 0xCF06EA0748793735ull, 0x6998E195E94589F4ull },
+		}
+	},
+	{
+		"keys", KEYS_ROM, sizeof(KEYS_ROM), QuirkProfile::SuperChip, 12,
+		{ {5, 0x0002}, {8, 0}, {10, 0x0040}, {40, 0x0044}, {70, 0x0110}, {100, 0x0001}, {103, 0}, {110, 0x0200}, {112, 0}, {150, 0x0010}, {200, 0} },
+		{
+			{ 1, 0xA5A4078B062CD464ull, 0x5B28D36CECEADE73ull },
+			{ 10, 0xA5A4078B062CD464ull, 0x947E7F1B466B9CD9ull },
+			{ 60, 0x23BE765803697205ull, 0x98C57E41E0CA5374ull },
+			{ 150, 0xCA9B345574FE8E74ull, 0x2A8B457511D75022ull },
+			{ 300, 0x40289D4AAF3BE045ull, 0x251C836A4D15F758ull },
+		}
+	},
+	{
+		"calls vip", CALLS_ROM, sizeof(CALLS_ROM), QuirkProfile::CosmacVip, 27,
+		{},
+		{
+			{ 1, 0xB9D103FD6854A325ull, 0xB261035310CFB54Full },
+			{ 10, 0xD588C0D7E5155DC5ull, 0xD79B2CD573384607ull },
+			{ 60, 0x0AFE464C76439115ull, 0x4D04A6C4120B0E33ull },
+			{ 150, 0x4C3E1B06FAD5DEE5ull, 0xD50126A597ADFE49ull },
+			{ 300, 0xB7B35FEDB8B47725ull, 0x95E882C3A5E34BA0ull },
+		}
+	},
+	{
+		"calls schip", CALLS_ROM, sizeof(CALLS_ROM), QuirkProfile::SuperChip, 27,
+		{},
+		{
+			{ 1, 0xB9D103FD6854A325ull, 0xB261035310CFB54Full },
+			{ 10, 0xD588C0D7E5155DC5ull, 0xD79B2CD573384607ull },
+			{ 60, 0x0AFE464C76439115ull, 0x3C624031D61FE655ull },
+			{ 150, 0x4C3E1B06FAD5DEE5ull, 0xD50126A597ADFE49ull },
+			{ 300, 0xB7B35FEDB8B47725ull, 0xB56EC34B956AE9FEull },
+		}
+	}
+};
+
+// Ways of running a ROM. Every one must match the reference interpreter
+// frame for frame; a new fast path gets an entry here.
+enum class Path
+{
+	Reference, // UpdateTimers, then EmulateCycle one instruction at a time
+	Unfused,   // RunFrame with fusion off
+	Fused,     // RunFrame with fusion on
+	Scheduler, // FrameScheduler with a fixed instruction count
+	Counted,   // FrameScheduler modelling the cycles of a fixed count
+	Debugger,  // The debugger's run loop, with a breakpoint never reached
+	Pool,      // A pool machine after a dirty-page reset
+	Shared,    // A pool machine sharing the golden image's pages
+	Count
+};
+
+static char const* PathName(Path path)
+{
+	switch (path)
+	{
+		case Path::Reference: return "reference";
+		case Path::Unfused: return "unfused";
+		case Path::Fused: return "fused";
+		case Path::Scheduler: return "scheduler";
+		case Path::Counted: return "counted";
+		case Path::Debugger: return "debugger";
+		case Path::Pool: return "pool";
+		case Path::Shared: return "shared";
+		default: return "?";
+	}
+}
+
+struct FrameHashes
+{
+	uint64_t display;
+	uint64_t machine;
+
+	bool operator==(FrameHashes const& other) const
+	{
+		return display == other.display && machine == other.machine;
+	}
+};
+
+// FNV-1a, kept separate from Chip8::Hash() so that a bug in the running
+// hash cannot hide a bug in the state
+static uint64_t Fnv(uint64_t hash, void const* data, size_t size)
+{
+	uint8_t const* bytes = static_cast<uint8_t const*>(data);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+	}
+	return hash;
+}
+
+static FrameHashes Hashes(Chip8 const& chip8)
+{
+	// GetState would miss shared pages
+	static Chip8State state;
+	chip8.SaveState(state);
+	uint64_t const basis = 0xCBF29CE484222325ull;
+
+	uint64_t machine = Fnv(basis, state.registers, sizeof(state.registers));
+	machine = Fnv(machine, &state.index, sizeof(state.index));
+	machine = Fnv(machine, &state.programCounter, sizeof(state.programCounter));
+	machine = Fnv(machine, state.stack, sizeof(state.stack));
+	machine = Fnv(machine, &state.stackPointer, sizeof(state.stackPointer));
+	machine = Fnv(machine, &state.delayTimer, sizeof(state.delayTimer));
+	machine = Fnv(machine, &state.soundTimer, sizeof(state.soundTimer));
+	machine = Fnv(machine, &state.randomState, sizeof(state.randomState));
+	machine = Fnv(machine, &state.trap, sizeof(state.trap));
+	machine = Fnv(machine, state.memory, sizeof(state.memory));
+
+	return FrameHashes{ Fnv(basis, state.display, sizeof(state.display)), machine };
+}
+
+static uint16_t KeysAt(TestRom const& rom, unsigned int frame)
+{
+	uint16_t keys = 0;
+	for (KeyEvent const& event : rom.keys)
+	{
+		if (event.frame <= frame)
+		{
+			keys = event.keys;
+		}
+	}
+	return keys;
+}
+
+static void RunFrames(TestRom const& rom, Path path, Chip8& chip8, unsigned int frames,
+	std::vector<FrameHashes>* hashes)
+{
+	FrameScheduler scheduler(rom.cyclesPerFrame, 0, path == Path::Counted);
+	Debugger debugger;
+	// Test ROMs start at 0x200 and never jump below it
+	debugger.AddBreakpoint(0);
+
+	for (unsigned int frame = 0; frame < frames; ++frame)
+	{
+		uint16_t keys = KeysAt(rom, frame);
+		for (unsigned int key = 0; key < KEY_COUNT; ++key)
+		{
+			chip8.keyPad[key] = (keys >> key) & 1u;
+		}
+
+		switch (path)
+		{
+			case Path::Reference:
+				chip8.UpdateTimers();
+				for (unsigned int i = 0; i < rom.cyclesPerFrame; ++i)
+				{
+					chip8.EmulateCycle();
+				}
+				break;
+
+			case Path::Scheduler:
+			case Path::Counted:
+				scheduler.RunFrame(chip8);
+				break;
+
+			case Path::Debugger:
+				CHECK(debugger.RunFrame(chip8, scheduler) == StopReason::None);
+				break;
+
+			default:
+				chip8.RunFrame(rom.cyclesPerFrame);
+				break;
+		}
+
+		if (hashes != nullptr)
+		{
+			hashes->push_back(Hashes(chip8));
+		}
+	}
+}
+
+// Hashes after every frame, run the given way
+static std::vector<FrameHashes> Run(TestRom const& rom, Path path, unsigned int frames)
+{
+	std::vector<FrameHashes> hashes;
+	Chip8Pool pool(1, path == Path::Shared ? PoolMemory::Shared : PoolMemory::Private);
+	Chip8 machine;
+	Chip8* chip8 = &machine;
+
+	if (path == Path::Pool || path == Path::Shared)
+	{
+		// Dirty some pages first, so the run starts from a partial restore
+		chip8 = pool.Acquire(pool.AddROM(rom.data, rom.size, rom.profile));
+		chip8->Seed(2);
+		RunFrames(rom, path, *chip8, frames / 2, nullptr);
+		pool.Reset(chip8);
+	}
+	else
+	{
+		machine.SetQuirkProfile(rom.profile);
+		machine.LoadROM(rom.data, rom.size);
+	}
+
+	chip8->Seed(1);
+	chip8->SetFusion(path == Path::Fused || path == Path::Pool || path == Path::Shared);
+	RunFrames(rom, path, *chip8, frames, &hashes);
+	CHECK_EQUAL(chip8->Hash(), chip8->FullHash());
+	return hashes;
+}
+
+static void PrintCheckpoints(TestRom const& rom, std::vector<FrameHashes> const& hashes)
+{
+	std::printf("%s:\n", rom.name);
+	for (Checkpoint const& checkpoint : rom.checkpoints)
+	{
+		FrameHashes const& expected = hashes[checkpoint.frame - 1];
+		std::printf("\t\t\t{ %u, 0x%016llXull, 0x%016llXull },\n", checkpoint.frame,
+			static_cast<unsigned long long>(expected.display), static_cast<unsigned long long>(expected.machine));
+	}
+}
+
+// Every other path must match the reference frame for frame
+static void ComparePaths(TestRom const& rom, unsigned int frames, std::vector<FrameHashes> const& reference)
+{
+	for (unsigned int path = 1; path < static_cast<unsigned int>(Path::Count); ++path)
+	{
+		std::vector<FrameHashes> hashes = Run(rom, static_cast<Path>(path), frames);
+		for (unsigned int frame = 0; frame < frames; ++frame)
+		{
+			if (!(hashes[frame] == reference[frame]))
+			{
+				std::fprintf(stderr, "%s: the %s path differs from the reference after frame %u\n",
+					rom.name, PathName(static_cast<Path>(path)), frame + 1);
+				++CheckFailures();
+				break;
+			}
+		}
+	}
+}
+
+static void TestRomConformance(TestRom const& rom, bool print)
+{
+	unsigned int frames = rom.checkpoints.back().frame;
+	std::vector<FrameHashes> reference = Run(rom, Path::Reference, frames);
+
+	if (print)
+	{
+		PrintCheckpoints(rom, reference);
+		return;
+	}
+
+	for (Checkpoint const& checkpoint : rom.checkpoints)
+	{
+		FrameHashes const& actual = reference[checkpoint.frame - 1];
+		if (actual.display != checkpoint.display || actual.machine != checkpoint.machine)
+		{
+			std::fprintf(stderr, "%s: frame %u has display 0x%016llX machine 0x%016llX, expected 0x%016llX 0x%016llX\n",
+				rom.name, checkpoint.frame, static_cast<unsigned long long>(actual.display),
+				static_cast<unsigned long long>(actual.machine), static_cast<unsigned long long>(checkpoint.display),
+				static_cast<unsigned long long>(checkpoint.machine));
+			++CheckFailures();
+		}
+	}
+
+	ComparePaths(rom, frames, reference);
+}
+
+// Generated workloads must halt in their expected state under every
+// profile, and every path must match the reference on the way there
+static void TestWorkload(Workload workload, QuirkProfile profile)
+{
+	WorkloadOptions options;
+	options.iterations = 5;
+	WorkloadRom generated;
+	CHECK(GenerateWorkload(workload, options, generated));
+
+	Chip8 chip8;
+	chip8.SetQuirkProfile(profile);
+	chip8.LoadROM(generated.data.data(), generated.data.size());
+	for (uint64_t i = 0; i < generated.instructions; ++i)
+	{
+		chip8.EmulateCycle();
+	}
+	std::string name = std::string(WorkloadName(workload)) + " " + QuirkProfileName(profile);
+	if (!CheckWorkload(chip8, generated))
+	{
+		std::fprintf(stderr, "%s: wrong end state\n", name.c_str());
+		++CheckFailures();
+	}
+
+	TestRom rom = { name.c_str(), generated.data.data(), generated.data.size(), profile, 20, {}, {} };
+	unsigned int frames = generated.instructions / rom.cyclesPerFrame + 2;
+	ComparePaths(rom, frames, Run(rom, Path::Reference, frames));
+}
+
+// Code that keeps patching itself makes its page fall back to plain
+// dispatch, and a copy of the machine decodes its sequences afresh
+static void TestFusionFallback()
+{
+	WorkloadOptions options;
+	options.iterations = 200;
+	WorkloadRom generated;
+	CHECK(GenerateWorkload(Workload::SelfModify, options, generated));
+
+	Chip8 chip8;
+	chip8.LoadROM(generated.data.data(), generated.data.size());
+	unsigned int const cyclesPerFrame = 100;
+	unsigned int frames = generated.instructions / cyclesPerFrame + 2;
+	for (unsigned int frame = 0; frame < frames / 2; ++frame)
+	{
+		chip8.RunFrame(cyclesPerFrame);
+	}
+
+	Chip8 copy = chip8;
+	for (unsigned int frame = frames / 2; frame < frames; ++frame)
+	{
+		chip8.RunFrame(cyclesPerFrame);
+		copy.RunFrame(cyclesPerFrame);
+	}
+	CHECK(CheckWorkload(chip8, generated));
+	CHECK(CheckWorkload(copy, generated));
+	CHECK_EQUAL(copy.Hash(), chip8.Hash());
+}
+
+// Wall sessions run like single machines, and each tile of the atlas
+// shows its session's display
+static void TestWall()
+{
+	SessionWall wall(5, 3);
+	std::vector<Chip8> machines(wall.Sessions());
+	for (unsigned int session = 0; session < wall.Sessions(); ++session)
+	{
+		TestRom const& rom = TEST_ROMS[session];
+		for (Chip8* chip8 : { &wall.Session(session), &machines[session] })
+		{
+			chip8->SetQuirkProfile(rom.profile);
+			chip8->Seed(1);
+			chip8->LoadROM(rom.data, rom.size);
+		}
+		wall.SetTiming(session, rom.cyclesPerFrame, 0);
+	}
+	CHECK_EQUAL(wall.AtlasWidth(), 3 * DISPLAY_WIDTH);
+	CHECK_EQUAL(wall.AtlasHeight(), 2 * DISPLAY_HEIGHT);
+	CHECK_EQUAL(wall.SessionAt(2 * DISPLAY_WIDTH, DISPLAY_HEIGHT), -1);
+
+	Chip8State expected;
+	for (unsigned int frame = 0; frame < 60; ++frame)
+	{
+		unsigned int firstRow = 0;
+		unsigned int endRow = 0;
+		wall.RunFrame(firstRow, endRow);
+		CHECK(firstRow <= endRow && endRow <= wall.AtlasHeight());
+
+		for (unsigned int session = 0; session < wall.Sessions(); ++session)
+		{
+			machines[session].RunFrame(TEST_ROMS[session].cyclesPerFrame);
+			machines[session].SaveState(expected);
+			CHECK(wall.Session(session).Matches(expected));
+			CHECK_EQUAL(wall.SessionAt(wall.TileX(session), wall.TileY(session)), static_cast<int>(session));
+
+			for (unsigned int row = 0; row < DISPLAY_HEIGHT; ++row)
+			{
+				uint32_t const* tile = wall.Atlas() + (wall.TileY(session) + row) * wall.AtlasWidth() + wall.TileX(session);
+				CHECK(std::memcmp(tile, machines[session].display + row * DISPLAY_WIDTH, DISPLAY_WIDTH * sizeof(uint32_t)) == 0);
+			}
+		}
+	}
+}
+
+// A debugger stop ends the frame, and the scheduler counts the
+// instructions run before it
+static void TestDebuggerFrames()
+{
+	static uint8_t const program[] = { 0x60, 0x01, 0x61, 0x02, 0x62, 0x03, 0x12, 0x06 };
+	Chip8 chip8;
+	chip8.LoadROM(program, sizeof(program));
+	FrameScheduler scheduler(10, 0);
+	Debugger debugger;
+	debugger.AddBreakpoint(0x204);
+
+	CHECK(debugger.RunFrame(chip8, scheduler) == StopReason::Breakpoint);
+	CHECK_EQUAL(scheduler.Instructions(), 2u);
+	CHECK(debugger.RunFrame(chip8, scheduler) == StopReason::None);
+	CHECK_EQUAL(scheduler.Instructions(), 12u);
+	CHECK_EQUAL(scheduler.Frames(), 2u);
+
+	// With a cycle budget, the frame runs as long as the budget allows
+	FrameScheduler budgeted(10, VIP_CYCLE_BUDGET);
+	chip8.init();
+	chip8.LoadROM(program, sizeof(program));
+	debugger.RemoveBreakpoint(0x204);
+	debugger.AddBreakpoint(0x100);
+	CHECK(debugger.RunFrame(chip8, budgeted) == StopReason::None);
+	CHECK(budgeted.Instructions() > 10u);
+	CHECK(budgeted.Cycles() >= VIP_CYCLE_BUDGET);
+}
+
+static void WriteTrace(char const* filename, bool compress, std::vector<TraceRecord> const& records)
+{
+	TraceSink sink(filename, compress);
+	CHECK(sink.IsOpen());
+	for (TraceRecord const& record : records)
+	{
+		sink.Push(record);
+	}
+}
+
+static std::vector<TraceRecord> ReadTrace(char const* filename)
+{
+	std::vector<TraceRecord> records;
+	TraceReader reader(filename);
+	CHECK(reader.IsOpen());
+	TraceRecord record;
+	while (reader.Next(record))
+	{
+		records.push_back(record);
+	}
+	return records;
+}
+
+static unsigned long DivergenceStep(char const* first, char const* second, TraceDivergence& divergence)
+{
+	TraceReader a(first);
+	TraceReader b(second);
+	divergence = DiffTraces(a, b, 4);
+	return divergence.step;
+}
+
+// Traces read back as written, plain and compressed, and a diff finds
+// the first record that differs
+static void TestTraceRoundTrip()
+{
+	// PC and I jump both ways by every varint length, including the wrap
+	// at the end of memory, and registers change in every combination
+	std::vector<TraceRecord> records;
+	uint32_t random = 1;
+	for (unsigned int i = 0; i < 3000; ++i)
+	{
+		random = random * 1103515245u + 12345u;
+		TraceRecord record;
+		record.pc = i % 7 == 0 ? random >> 20 & ADDRESS_MASK : (records.empty() ? 0x200 : records.back().pc + 2) & ADDRESS_MASK;
+		record.opcode = random >> 8;
+		record.changedRegisters = i % 3 == 0 ? 0 : random >> 16;
+		for (unsigned int reg = 0; reg < REGISTER_COUNT; ++reg)
+		{
+			record.registers[reg] = (record.changedRegisters >> reg & 1u) ? random >> reg : 0;
+		}
+		record.indexChanged = i % 5 == 0;
+		record.index = record.indexChanged ? random >> 4 : (records.empty() ? 0 : records.back().index);
+		records.push_back(record);
+	}
+	records[10].pc = 0xFFE;
+	records[11].pc = 0x000;
+	records[12].pc = 0xFFE;
+
+	char const* plainFilename = "conformance-plain.trace";
+	char const* gzipFilename = "conformance-gzip.trace";
+	char const* perturbedFilename = "conformance-perturbed.trace";
+	char const* shortFilename = "conformance-short.trace";
+
+	WriteTrace(plainFilename, false, records);
+	WriteTrace(gzipFilename, true, records);
+	for (char const* filename : { plainFilename, gzipFilename })
+	{
+		std::vector<TraceRecord> read = ReadTrace(filename);
+		CHECK_EQUAL(read.size(), records.size());
+		for (size_t i = 0; i < read.size() && i < records.size(); ++i)
+		{
+			CHECK(SameRecord(read[i], records[i]));
+		}
+	}
+
+#ifdef CHIP8_HAVE_ZLIB
+	// The compressed file really is gzip
+	FILE* file = std::fopen(gzipFilename, "rb");
+	CHECK(file != nullptr);
+	if (file != nullptr)
+	{
+		CHECK_EQUAL(std::fgetc(file), 0x1Fu);
+		CHECK_EQUAL(std::fgetc(file), 0x8Bu);
+		std::fclose(file);
+	}
+#endif
+
+	TraceDivergence divergence;
+	CHECK_EQUAL(DivergenceStep(plainFilename, gzipFilename, divergence), records.size());
+	CHECK(divergence.identical);
+
+	// One changed register value in one instruction
+	std::vector<TraceRecord> perturbed = records;
+	perturbed[1234].changedRegisters |= 1u;
+	perturbed[1234].registers[0] ^= 1u;
+	WriteTrace(perturbedFilename, true, perturbed);
+	CHECK_EQUAL(DivergenceStep(gzipFilename, perturbedFilename, divergence), 1234u);
+	CHECK(!divergence.identical && divergence.hasFirst && divergence.hasSecond);
+	CHECK(SameRecord(divergence.first, records[1234]));
+	CHECK(SameRecord(divergence.second, perturbed[1234]));
+	CHECK_EQUAL(divergence.context.size(), 4u);
+	CHECK(SameRecord(divergence.context.front(), records[1230]));
+	CHECK(SameRecord(divergence.context.back(), records[1233]));
+
+	// A trace that stops early parts where it ends
+	WriteTrace(shortFilename, false, std::vector<TraceRecord>(records.begin(), records.begin() + 2));
+	CHECK_EQUAL(DivergenceStep(plainFilename, shortFilename, divergence), 2u);
+	CHECK(divergence.hasFirst && !divergence.hasSecond);
+	CHECK_EQUAL(divergence.context.size(), 2u);
+
+	// A traced machine records every instruction it runs
+	Chip8 chip8;
+	chip8.SetQuirkProfile(TEST_ROMS[0].profile);
+	chip8.LoadROM(TEST_ROMS[0].data, TEST_ROMS[0].size);
+	{
+		TraceSink sink(plainFilename, true);
+		chip8.SetTraceSink(&sink);
+		for (unsigned int frame = 0; frame < 30; ++frame)
+		{
+			chip8.RunFrame(TEST_ROMS[0].cyclesPerFrame);
+		}
+		chip8.SetTraceSink(nullptr);
+	}
+	std::vector<TraceRecord> traced = ReadTrace(plainFilename);
+	CHECK_EQUAL(traced.size(), 30u * TEST_ROMS[0].cyclesPerFrame);
+	CHECK_EQUAL(traced.empty() ? 0 : traced.front().pc, 0x200u);
+
+	for (char const* filename : { plainFilename, gzipFilename, perturbedFilename, shortFilename })
+	{
+		std::remove(filename);
+	}
+}
+
+// A pack built from the test ROMs gives back each one, by name and by
+// hash, with its metadata, straight from the mapping
+static void TestRomPack()
+{
+	std::vector<RomPackInput> inputs;
+	for (size_t rom = TEST_ROMS.size(); rom-- > 0;)
+	{
+		RomPackInput input;
+		input.name = TEST_ROMS[rom].name;
+		input.data.assign(TEST_ROMS[rom].data, TEST_ROMS[rom].data + TEST_ROMS[rom].size);
+		input.profile = TEST_ROMS[rom].profile;
+		input.instructionsPerFrame = TEST_ROMS[rom].cyclesPerFrame + rom;
+		input.keyMap[rom] = 'a' + rom;
+		inputs.push_back(input);
+	}
+
+	char const* filename = "conformance.pack";
+	CHECK(WriteRomPack(filename, inputs));
+	{
+		RomPack pack;
+		CHECK(pack.Open(filename));
+		CHECK_EQUAL(pack.Count(), TEST_ROMS.size());
+
+		for (size_t rom = 0; rom < TEST_ROMS.size() && pack.Count() == TEST_ROMS.size(); ++rom)
+		{
+			TestRom const& test = TEST_ROMS[rom];
+			RomPackEntry const* entry = pack.FindName(test.name);
+			CHECK(entry != nullptr);
+			if (entry == nullptr)
+			{
+				continue;
+			}
+			// Test ROMs that differ only in profile share a hash, and so
+			// share the entry found by it
+			RomPackEntry const* byHash = pack.FindHash(RomHash(test.data, test.size));
+			CHECK(byHash != nullptr && byHash->hash == entry->hash && byHash->dataSize == test.size
+				&& std::memcmp(pack.Data(*byHash), test.data, test.size) == 0);
+			CHECK(std::strcmp(pack.Name(*entry), test.name) == 0);
+			CHECK_EQUAL(entry->dataSize, test.size);
+			CHECK(std::memcmp(pack.Data(*entry), test.data, test.size) == 0);
+			CHECK(pack.Profile(*entry) == test.profile);
+			CHECK_EQUAL(entry->instructionsPerFrame, test.cyclesPerFrame + rom);
+			for (unsigned int key = 0; key < KEY_COUNT; ++key)
+			{
+				CHECK_EQUAL(entry->keyMap[key], key == rom ? 'a' + rom : 0);
+			}
+
+			// Loading from the pack is loading the same bytes
+			Chip8 fromPack;
+			Chip8 fromData;
+			fromPack.Seed(1);
+			fromData.Seed(1);
+			CHECK(fromPack.LoadROM(pack, *entry));
+			CHECK(fromData.LoadROM(test.data, test.size));
+			Chip8State expected;
+			fromData.SaveState(expected);
+			CHECK(fromPack.Matches(expected));
+		}
+
+		// Entries are sorted by name for the lookup
+		for (size_t entry = 1; entry < pack.Count(); ++entry)
+		{
+			CHECK(std::strcmp(pack.Name(pack.Entry(entry - 1)), pack.Name(pack.Entry(entry))) < 0);
+		}
+		CHECK(pack.FindName("missing") == nullptr);
+		CHECK(pack.FindHash(RomHash(nullptr, 0)) == nullptr);
+	}
+
+	// A truncated pack is refused rather than read out of bounds
+	std::vector<char> bytes;
+	FILE* file = std::fopen(filename, "rb");
+	CHECK(file != nullptr);
+	if (file != nullptr)
+	{
+		int c;
+		while ((c = std::fgetc(file)) != EOF)
+		{
+			bytes.push_back(static_cast<char>(c));
+		}
+		std::fclose(file);
+	}
+	file = std::fopen(filename, "wb");
+	CHECK(file != nullptr);
+	if (file != nullptr)
+	{
+		std::fwrite(bytes.data(), 1, bytes.size() - 1, file);
+		std::fclose(file);
+	}
+	RomPack truncated;
+	CHECK(!truncated.Open(filename));
+	std::remove(filename);
+}
+
+// Pool machines are seeded from their slot, so two pools acquired the
+// same way start in the same state while slots of one pool differ
+static void TestPoolSeeding()
+{
+	TestRom const& rom = TEST_ROMS[0];
+	Chip8Pool first(2);
+	Chip8Pool second(2);
+	int firstRom = first.AddROM(rom.data, rom.size, rom.profile);
+	int secondRom = second.AddROM(rom.data, rom.size, rom.profile);
+	Chip8* firstSlot0 = first.Acquire(firstRom);
+	Chip8* firstSlot1 = first.Acquire(firstRom);
+	Chip8* secondSlot0 = second.Acquire(secondRom);
+	CHECK_EQUAL(firstSlot0->Hash(), secondSlot0->Hash());
+	CHECK(firstSlot0->Hash() != firstSlot1->Hash());
+
+	firstSlot0->RunFrame(rom.cyclesPerFrame);
+	first.Reset(firstSlot0);
+	CHECK_EQUAL(firstSlot0->Hash(), secondSlot0->Hash());
+}
+
+int main(int argc, char** argv)
+{
+	bool print = argc > 1 && std::strcmp(argv[1], "--print") == 0;
+
+	for (TestRom const& rom : TEST_ROMS)
+	{
+		TestRomConformance(rom, print);
+	}
+
+	for (unsigned int workload = 0; workload < static_cast<unsigned int>(Workload::Count) && !print; ++workload)
+	{
+		TestWorkload(static_cast<Workload>(workload), QuirkProfile::CosmacVip);
+		TestWorkload(static_cast<Workload>(workload), QuirkProfile::Modern);
+	}
+	if (!print)
+	{
+		TestFusionFallback();
+		TestWall();
+		TestPoolSeeding();
+		TestDebuggerFrames();
+		TestTraceRoundTrip();
+		TestRomPack();
+	}
+
+	if (CheckFailures() != 0)
+	{
+		std::fprintf(stderr, "%u checks failed\n", CheckFailures());
+		return 1;
+	}
+	return 0;
+}
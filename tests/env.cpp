@@ -0,0 +1,140 @@
+#include <cstdint>
+#include <vector>
+#include "../src/env.hpp"
+#include "check.hpp"
+
+// Puts a random byte in V2, then draws the font's 0 at (10, 5) and spins
+static uint8_t const DRAW_ROM[] = {
+	0xC2, 0xFF, // C2FF    V2 = random
+	0x60, 0x0A, // 600A    V0 = 10
+	0x61, 0x05, // 6105    V1 = 5
+	0xA0, 0x50, // A050    I = glyph 0
+	0xD0, 0x15, // D015    draw 8x5 at (V0, V1)
+	0x12, 0x0A, // 120A    spin
+};
+
+// The glyph's rows, 0xF0 0x90 0x90 0x90 0xF0, from (10, 5)
+static bool GlyphPixel(unsigned int x, unsigned int y)
+{
+	if (x < 10 || x >= 14 || y < 5 || y >= 10)
+	{
+		return false;
+	}
+	return y == 5 || y == 9 || x == 10 || x == 13;
+}
+
+static void TestEmptyBatch()
+{
+	Env env(0, ObservationFormat::Pixels);
+	CHECK_EQUAL(env.Count(), 0u);
+	CHECK(env.LoadROM(DRAW_ROM, sizeof(DRAW_ROM)));
+	env.Reset(1);
+	env.Step(nullptr, 1);
+}
+
+static void TestPixels()
+{
+	Env env(2, ObservationFormat::Pixels);
+	CHECK_EQUAL(env.ObservationSize(), DISPLAY_WIDTH * DISPLAY_HEIGHT);
+	CHECK(env.LoadROM(DRAW_ROM, sizeof(DRAW_ROM)));
+
+	// Nothing is drawn until the first step
+	for (unsigned int i = 0; i < env.ObservationSize(); ++i)
+	{
+		CHECK_EQUAL(env.GetObservation(1)[i], 0u);
+	}
+
+	uint16_t actions[] = { 0, 0 };
+	env.Step(actions, 1);
+	for (unsigned int y = 0; y < DISPLAY_HEIGHT; ++y)
+	{
+		for (unsigned int x = 0; x < DISPLAY_WIDTH; ++x)
+		{
+			CHECK_EQUAL(env.GetObservation(1)[y * DISPLAY_WIDTH + x], GlyphPixel(x, y));
+		}
+	}
+	CHECK(env.Observations() + env.ObservationSize() == env.GetObservation(1));
+}
+
+static void TestPackedBits()
+{
+	Env env(1, ObservationFormat::PackedBits);
+	CHECK_EQUAL(env.ObservationSize(), DISPLAY_WIDTH * DISPLAY_HEIGHT / 8);
+	CHECK(env.LoadROM(DRAW_ROM, sizeof(DRAW_ROM)));
+
+	uint16_t action = 0;
+	env.Step(&action, 1);
+	// Pixels 8 to 15 of each row, leftmost in the high bit
+	uint8_t const* observation = env.GetObservation(0);
+	CHECK_EQUAL(observation[5 * 8 + 1], 0x3Cu);
+	CHECK_EQUAL(observation[6 * 8 + 1], 0x24u);
+	CHECK_EQUAL(observation[9 * 8 + 1], 0x3Cu);
+	CHECK_EQUAL(observation[10 * 8 + 1], 0u);
+	CHECK_EQUAL(observation[5 * 8], 0u);
+}
+
+static void TestDownsampled()
+{
+	Env env(1, ObservationFormat::Downsampled);
+	CHECK_EQUAL(env.ObservationSize(), (DISPLAY_WIDTH / 2) * (DISPLAY_HEIGHT / 2));
+	CHECK(env.LoadROM(DRAW_ROM, sizeof(DRAW_ROM)));
+
+	uint16_t action = 0;
+	env.Step(&action, 1);
+	for (unsigned int y = 0; y < DISPLAY_HEIGHT / 2; ++y)
+	{
+		for (unsigned int x = 0; x < DISPLAY_WIDTH / 2; ++x)
+		{
+			bool set = GlyphPixel(2 * x, 2 * y) || GlyphPixel(2 * x + 1, 2 * y)
+				|| GlyphPixel(2 * x, 2 * y + 1) || GlyphPixel(2 * x + 1, 2 * y + 1);
+			CHECK_EQUAL(env.GetObservation(0)[y * (DISPLAY_WIDTH / 2) + x], set);
+		}
+	}
+}
+
+// Reset restores the loaded image and seeds environment i with seed + i
+static void TestReset()
+{
+	Env env(2, ObservationFormat::Pixels, DEFAULT_CYCLES_PER_FRAME, QuirkProfile::CosmacVip);
+	CHECK(env.GetMachine(1).GetQuirkProfile() == QuirkProfile::CosmacVip);
+	CHECK(env.LoadROM(DRAW_ROM, sizeof(DRAW_ROM)));
+
+	uint16_t actions[] = { 0x0002, 0x8000 };
+	env.Reset(7);
+	env.Step(actions, 2);
+	CHECK_EQUAL(env.GetMachine(0).keyPad[1], 1u);
+	CHECK_EQUAL(env.GetMachine(1).keyPad[15], 1u);
+	uint8_t first = env.GetMachine(0).GetState().registers[2];
+	uint8_t second = env.GetMachine(1).GetState().registers[2];
+	CHECK(first != second);
+	CHECK(env.GetMachine(0).GetQuirkProfile() == QuirkProfile::CosmacVip);
+
+	env.Reset(7);
+	CHECK_EQUAL(env.GetMachine(0).GetState().programCounter, 0x200u);
+	CHECK_EQUAL(env.GetObservation(0)[5 * DISPLAY_WIDTH + 10], 0u);
+	env.Step(actions, 1);
+	CHECK_EQUAL(env.GetMachine(0).GetState().registers[2], first);
+
+	// Resetting one environment leaves the others alone
+	env.Reset(1, 8);
+	CHECK_EQUAL(env.GetMachine(1).GetState().programCounter, 0x200u);
+	CHECK_EQUAL(env.GetMachine(0).GetState().programCounter, 0x20Au);
+	env.Step(actions, 1);
+	CHECK_EQUAL(env.GetMachine(1).GetState().registers[2], second);
+}
+
+int main()
+{
+	RUN_TEST(TestEmptyBatch);
+	RUN_TEST(TestPixels);
+	RUN_TEST(TestPackedBits);
+	RUN_TEST(TestDownsampled);
+	RUN_TEST(TestReset);
+
+	if (CheckFailures() != 0)
+	{
+		std::fprintf(stderr, "%u checks failed\n", CheckFailures());
+		return 1;
+	}
+	return 0;
+}
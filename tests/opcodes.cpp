@@ -0,0 +1,555 @@
+#include <initializer_list>
+#include <vector>
+#include "../src/chip8.hpp"
+#include "check.hpp"
+
+const unsigned int START_ADDRESS = 0x200;
+const unsigned int FONTSET_START_ADDRESS = 0x50;
+
+// Reset the machine and load the instructions at START_ADDRESS
+static void Load(Chip8& chip8, std::initializer_list<uint16_t> program,
+	QuirkProfile profile = DEFAULT_QUIRK_PROFILE)
+{
+	std::vector<uint8_t> bytes;
+	for (uint16_t instruction : program)
+	{
+		bytes.push_back(instruction >> 8);
+		bytes.push_back(instruction & 0xFF);
+	}
+
+	chip8.init();
+	chip8.SetQuirkProfile(profile);
+	chip8.Seed(1);
+	chip8.LoadROM(bytes.data(), bytes.size());
+}
+
+// Edit the state between instructions
+template<typename Edit>
+static void Modify(Chip8& chip8, Edit edit)
+{
+	Chip8State state;
+	chip8.SaveState(state);
+	edit(state);
+	chip8.LoadState(state);
+}
+
+static void SetRegister(Chip8& chip8, unsigned int reg, uint8_t value)
+{
+	Modify(chip8, [=](Chip8State& state) { state.registers[reg] = value; });
+}
+
+static void SetIndex(Chip8& chip8, uint16_t value)
+{
+	Modify(chip8, [=](Chip8State& state) { state.index = value; });
+}
+
+// Execute instructions one at a time, checking the running hash after each
+static void Step(Chip8& chip8, unsigned int count = 1)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		chip8.EmulateCycle();
+		CHECK_EQUAL(chip8.Hash(), chip8.FullHash());
+	}
+}
+
+static uint8_t V(Chip8 const& chip8, unsigned int reg)
+{
+	return chip8.GetState().registers[reg];
+}
+
+static uint16_t PC(Chip8 const& chip8)
+{
+	return chip8.GetState().programCounter;
+}
+
+static uint32_t Pixel(Chip8 const& chip8, unsigned int x, unsigned int y)
+{
+	return chip8.display[x + y * DISPLAY_WIDTH];
+}
+
+static unsigned int LitPixels(Chip8 const& chip8)
+{
+	unsigned int lit = 0;
+	for (uint32_t pixel : chip8.display)
+	{
+		lit += pixel;
+	}
+	return lit;
+}
+
+static void TestClearScreen()
+{
+	Chip8 chip8;
+	Load(chip8, {0xA000 | FONTSET_START_ADDRESS, 0xD005, 0x00E0});
+	Step(chip8, 2);
+	CHECK(LitPixels(chip8) > 0);
+	chip8.TakeDirtyRows();
+	Step(chip8);
+	CHECK_EQUAL(LitPixels(chip8), 0);
+	CHECK_EQUAL(chip8.TakeDirtyRows(), ALL_DISPLAY_ROWS);
+}
+
+static void TestCallReturn()
+{
+	Chip8 chip8;
+	Load(chip8, {0x2206, 0x6001, 0x1204, 0x00EE});
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x206);
+	CHECK_EQUAL(chip8.GetState().stackPointer, 1);
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x202);
+	CHECK_EQUAL(chip8.GetState().stackPointer, 0);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 0), 1);
+}
+
+static void TestStackTraps()
+{
+	Chip8 chip8;
+	Load(chip8, {0x00EE});
+	Step(chip8);
+	CHECK(chip8.GetTrap() == Trap::StackUnderflow);
+	CHECK_EQUAL(chip8.GetTrapAddress(), 0x200);
+
+	// A call to itself fills the stack on the 17th call
+	Load(chip8, {0x2200});
+	Step(chip8, STACK_LEVELS);
+	CHECK(chip8.GetTrap() == Trap::None);
+	Step(chip8);
+	CHECK(chip8.GetTrap() == Trap::StackOverflow);
+
+	// A trapped machine no longer executes
+	uint64_t hash = chip8.Hash();
+	Step(chip8);
+	CHECK_EQUAL(chip8.Hash(), hash);
+}
+
+static void TestUnknownOpcode()
+{
+	Chip8 chip8;
+	Load(chip8, {0x6001, 0xE0FF});
+	Step(chip8, 2);
+	CHECK(chip8.GetTrap() == Trap::UnknownOpcode);
+	CHECK_EQUAL(chip8.GetTrapAddress(), 0x202);
+}
+
+static void TestJumps()
+{
+	Chip8 chip8;
+	Load(chip8, {0x1ABC});
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0xABC);
+
+	// BNNN adds V0 on the VIP and VX on the SUPER-CHIP
+	Load(chip8, {0xB310}, QuirkProfile::CosmacVip);
+	SetRegister(chip8, 0, 0x04);
+	SetRegister(chip8, 3, 0x20);
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x314);
+
+	Load(chip8, {0xB310}, QuirkProfile::SuperChip);
+	SetRegister(chip8, 0, 0x04);
+	SetRegister(chip8, 3, 0x20);
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x330);
+}
+
+static void TestSkips()
+{
+	Chip8 chip8;
+	Load(chip8, {0x3142, 0x0000, 0x4142, 0x5120, 0x0000, 0x9120, 0x9130});
+	SetRegister(chip8, 1, 0x42);
+	SetRegister(chip8, 2, 0x42);
+	SetRegister(chip8, 3, 0x41);
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x204);
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x206);
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x20A);
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x20C);
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x210);
+}
+
+static void TestLoadAndAdd()
+{
+	Chip8 chip8;
+	Load(chip8, {0x6AFE, 0x7A03, 0x8BA0});
+	SetRegister(chip8, 0xF, 0x55);
+	Step(chip8, 3);
+	CHECK_EQUAL(V(chip8, 0xA), 0x01);
+	CHECK_EQUAL(V(chip8, 0xB), 0x01);
+	// 7XKK never touches the flag
+	CHECK_EQUAL(V(chip8, 0xF), 0x55);
+}
+
+static void TestLogic()
+{
+	Chip8 chip8;
+	for (QuirkProfile profile : {QuirkProfile::CosmacVip, QuirkProfile::SuperChip})
+	{
+		Load(chip8, {0x8011, 0x8022, 0x8033}, profile);
+		SetRegister(chip8, 0, 0x0C);
+		SetRegister(chip8, 1, 0x0A);
+		SetRegister(chip8, 2, 0x06);
+		SetRegister(chip8, 3, 0xFF);
+		SetRegister(chip8, 0xF, 0x55);
+		Step(chip8);
+		CHECK_EQUAL(V(chip8, 0), 0x0E);
+		Step(chip8);
+		CHECK_EQUAL(V(chip8, 0), 0x06);
+		Step(chip8);
+		CHECK_EQUAL(V(chip8, 0), 0xF9);
+		// Only the VIP clears the flag
+		CHECK_EQUAL(V(chip8, 0xF), profile == QuirkProfile::CosmacVip ? 0x00 : 0x55);
+	}
+}
+
+static void TestAdd()
+{
+	Chip8 chip8;
+	Load(chip8, {0x8014, 0x8014});
+	SetRegister(chip8, 0, 0x80);
+	SetRegister(chip8, 1, 0x7F);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 0), 0xFF);
+	CHECK_EQUAL(V(chip8, 0xF), 0);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 0), 0x7E);
+	CHECK_EQUAL(V(chip8, 0xF), 1);
+
+	// With VF as the destination the flag is what remains
+	Load(chip8, {0x8F04});
+	SetRegister(chip8, 0, 0x01);
+	SetRegister(chip8, 0xF, 0x02);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 0xF), 0);
+}
+
+static void TestSubtract()
+{
+	Chip8 chip8;
+	Load(chip8, {0x8015, 0x8015, 0x8015});
+	SetRegister(chip8, 0, 0x10);
+	SetRegister(chip8, 1, 0x08);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 0), 0x08);
+	CHECK_EQUAL(V(chip8, 0xF), 1);
+	// Equal operands do not borrow
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 0), 0x00);
+	CHECK_EQUAL(V(chip8, 0xF), 1);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 0), 0xF8);
+	CHECK_EQUAL(V(chip8, 0xF), 0);
+
+	Load(chip8, {0x8017, 0x8017, 0x8217});
+	SetRegister(chip8, 0, 0x08);
+	SetRegister(chip8, 1, 0x10);
+	SetRegister(chip8, 2, 0x11);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 0), 0x08);
+	CHECK_EQUAL(V(chip8, 0xF), 1);
+	SetRegister(chip8, 0, 0x10);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 0), 0x00);
+	CHECK_EQUAL(V(chip8, 0xF), 1);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 2), 0xFF);
+	CHECK_EQUAL(V(chip8, 0xF), 0);
+
+	// VF as an operand is read before the flag is written
+	Load(chip8, {0x80F5});
+	SetRegister(chip8, 0, 0x05);
+	SetRegister(chip8, 0xF, 0x05);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 0), 0x00);
+	CHECK_EQUAL(V(chip8, 0xF), 1);
+}
+
+static void TestShifts()
+{
+	Chip8 chip8;
+	for (QuirkProfile profile : {QuirkProfile::CosmacVip, QuirkProfile::SuperChip})
+	{
+		bool usesVy = profile == QuirkProfile::CosmacVip;
+
+		Load(chip8, {0x8016}, profile);
+		SetRegister(chip8, 0, 0x81);
+		SetRegister(chip8, 1, 0x02);
+		Step(chip8);
+		CHECK_EQUAL(V(chip8, 0), usesVy ? 0x01 : 0x40);
+		CHECK_EQUAL(V(chip8, 0xF), usesVy ? 0 : 1);
+
+		Load(chip8, {0x801E}, profile);
+		SetRegister(chip8, 0, 0x41);
+		SetRegister(chip8, 1, 0x81);
+		Step(chip8);
+		CHECK_EQUAL(V(chip8, 0), usesVy ? 0x02 : 0x82);
+		CHECK_EQUAL(V(chip8, 0xF), usesVy ? 1 : 0);
+	}
+}
+
+static void TestRandom()
+{
+	Chip8 first;
+	Chip8 second;
+	Load(first, {0xC0FF, 0xC10F, 0xC0FF, 0xC10F});
+	Load(second, {0xC0FF, 0xC10F, 0xC0FF, 0xC10F});
+
+	// The same seed gives the same numbers, and the mask applies
+	for (unsigned int i = 0; i < 2; ++i)
+	{
+		Step(first, 2);
+		Step(second, 2);
+		CHECK_EQUAL(V(first, 0), V(second, 0));
+		CHECK_EQUAL(V(first, 1) & 0xF0, 0);
+	}
+	Chip8State state;
+	second.SaveState(state);
+	CHECK(first.Matches(state));
+}
+
+static void TestDraw()
+{
+	Chip8 chip8;
+	Load(chip8, {0xA000 | FONTSET_START_ADDRESS, 0xD015, 0xD015});
+	SetRegister(chip8, 0, 2);
+	SetRegister(chip8, 1, 3);
+	Step(chip8);
+	chip8.TakeDirtyRows();
+	Step(chip8);
+	// The top row of "0" is 0xF0
+	CHECK_EQUAL(Pixel(chip8, 2, 3), 1);
+	CHECK_EQUAL(Pixel(chip8, 5, 3), 1);
+	CHECK_EQUAL(Pixel(chip8, 6, 3), 0);
+	CHECK_EQUAL(LitPixels(chip8), 14);
+	CHECK_EQUAL(V(chip8, 0xF), 0);
+	CHECK_EQUAL(chip8.TakeDirtyRows(), 0x1Fu << 3);
+
+	// Drawing again erases it and reports the collision
+	Step(chip8);
+	CHECK_EQUAL(LitPixels(chip8), 0);
+	CHECK_EQUAL(V(chip8, 0xF), 1);
+	CHECK_EQUAL(chip8.GetState().index, FONTSET_START_ADDRESS);
+}
+
+static void TestDrawAtEdges()
+{
+	Chip8 chip8;
+	for (QuirkProfile profile : {QuirkProfile::SuperChip, QuirkProfile::Modern})
+	{
+		bool wraps = profile == QuirkProfile::Modern;
+
+		// "0" at (62, 30): the start position is inside, the sprite is not
+		Load(chip8, {0xA000 | FONTSET_START_ADDRESS, 0xD015}, profile);
+		SetRegister(chip8, 0, 62);
+		SetRegister(chip8, 1, 30);
+		Step(chip8, 2);
+		CHECK_EQUAL(Pixel(chip8, 62, 30), 1);
+		CHECK_EQUAL(Pixel(chip8, 0, 30), wraps ? 1 : 0);
+		CHECK_EQUAL(Pixel(chip8, 62, 0), wraps ? 1 : 0);
+		CHECK_EQUAL(LitPixels(chip8), wraps ? 14 : 3);
+
+		// The start position always wraps
+		Load(chip8, {0xA000 | FONTSET_START_ADDRESS, 0xD011}, profile);
+		SetRegister(chip8, 0, 64 + 1);
+		SetRegister(chip8, 1, 32 + 2);
+		Step(chip8, 2);
+		CHECK_EQUAL(Pixel(chip8, 1, 2), 1);
+	}
+}
+
+static void TestKeys()
+{
+	Chip8 chip8;
+	Load(chip8, {0xE59E, 0x0000, 0xE5A1, 0x0000});
+	SetRegister(chip8, 5, 0xA);
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x202);
+	Load(chip8, {0xE59E, 0x0000, 0xE5A1, 0x0000});
+	SetRegister(chip8, 5, 0xA);
+	chip8.keyPad[0xA] = 1;
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x204);
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x206);
+}
+
+static void TestWaitForKey()
+{
+	Chip8 chip8;
+	Load(chip8, {0xF30A, 0x1202});
+	Step(chip8, 3);
+	CHECK_EQUAL(PC(chip8), 0x200);
+	chip8.keyPad[0x7] = 1;
+	chip8.keyPad[0xC] = 1;
+	Step(chip8);
+	CHECK_EQUAL(PC(chip8), 0x202);
+	// The lowest pressed key wins
+	CHECK_EQUAL(V(chip8, 3), 0x7);
+}
+
+static void TestTimers()
+{
+	Chip8 chip8;
+	Load(chip8, {0xF115, 0xF218, 0xF307});
+	SetRegister(chip8, 1, 3);
+	SetRegister(chip8, 2, 1);
+	Step(chip8, 2);
+	chip8.UpdateTimers();
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 3), 2);
+	CHECK_EQUAL(chip8.GetSoundTimer(), 0);
+	// Timers stop at zero
+	chip8.UpdateTimers();
+	chip8.UpdateTimers();
+	chip8.UpdateTimers();
+	CHECK_EQUAL(chip8.GetState().delayTimer, 0);
+	CHECK_EQUAL(chip8.GetSoundTimer(), 0);
+}
+
+static void TestIndex()
+{
+	Chip8 chip8;
+	Load(chip8, {0xA123, 0xF01E, 0xF129});
+	SetRegister(chip8, 0, 0x10);
+	SetRegister(chip8, 1, 0xA);
+	Step(chip8);
+	CHECK_EQUAL(chip8.GetState().index, 0x123);
+	Step(chip8);
+	CHECK_EQUAL(chip8.GetState().index, 0x133);
+	Step(chip8);
+	CHECK_EQUAL(chip8.GetState().index, FONTSET_START_ADDRESS + 5 * 0xA);
+}
+
+static void TestDecimal()
+{
+	Chip8 chip8;
+	// The digits come from the value of V5, not from its number
+	Load(chip8, {0xF533, 0xF033});
+	SetIndex(chip8, 0x300);
+	SetRegister(chip8, 5, 254);
+	Step(chip8);
+	CHECK_EQUAL(chip8.ReadMemory(0x300), 2);
+	CHECK_EQUAL(chip8.ReadMemory(0x301), 5);
+	CHECK_EQUAL(chip8.ReadMemory(0x302), 4);
+	CHECK_EQUAL(chip8.GetState().index, 0x300);
+
+	SetRegister(chip8, 0, 7);
+	Step(chip8);
+	CHECK_EQUAL(chip8.ReadMemory(0x300), 0);
+	CHECK_EQUAL(chip8.ReadMemory(0x301), 0);
+	CHECK_EQUAL(chip8.ReadMemory(0x302), 7);
+}
+
+static void TestStoreLoad()
+{
+	Chip8 chip8;
+	QuirkProfile const profiles[] = {QuirkProfile::CosmacVip, QuirkProfile::Chip48, QuirkProfile::SuperChip};
+	uint16_t const finalIndex[] = {0x303, 0x302, 0x300};
+
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		Load(chip8, {0xF255, 0xA300, 0x6000, 0x6100, 0x6200, 0x6309, 0xF265}, profiles[i]);
+		SetIndex(chip8, 0x300);
+		SetRegister(chip8, 0, 0x11);
+		SetRegister(chip8, 1, 0x22);
+		SetRegister(chip8, 2, 0x33);
+		SetRegister(chip8, 3, 0x44);
+		Step(chip8);
+		CHECK_EQUAL(chip8.ReadMemory(0x300), 0x11);
+		CHECK_EQUAL(chip8.ReadMemory(0x302), 0x33);
+		CHECK_EQUAL(chip8.ReadMemory(0x303), 0x00);
+		CHECK_EQUAL(chip8.GetState().index, finalIndex[i]);
+
+		Step(chip8, 6);
+		CHECK_EQUAL(V(chip8, 0), 0x11);
+		CHECK_EQUAL(V(chip8, 2), 0x33);
+		CHECK_EQUAL(V(chip8, 3), 0x09);
+		CHECK_EQUAL(chip8.GetState().index, finalIndex[i]);
+	}
+}
+
+static void TestSelfModifyingCode()
+{
+	Chip8 chip8;
+	// Overwrite the 6155 at 0x20A with 6177 before it runs
+	Load(chip8, {0xA20A, 0x6061, 0x6177, 0xF155, 0x6100, 0x6155});
+	Step(chip8, 5);
+	CHECK_EQUAL(V(chip8, 1), 0x00);
+	Step(chip8);
+	CHECK_EQUAL(V(chip8, 1), 0x77);
+}
+
+static void TestSharedMemory()
+{
+	Chip8 loader;
+	Load(loader, {0xA300, 0x6042, 0xF033, 0x1206});
+	Chip8State image;
+	loader.SaveState(image);
+
+	Chip8 first;
+	Chip8 second;
+	first.LoadShared(image);
+	second.LoadShared(image);
+	CHECK_EQUAL(first.GetSharedPages(), ALL_MEMORY_PAGES);
+	CHECK(first.Matches(image));
+
+	// FX33 copies page 3 and leaves the image alone
+	Step(first, 3);
+	CHECK_EQUAL(first.GetSharedPages(), ALL_MEMORY_PAGES & ~(1u << 3));
+	CHECK_EQUAL(first.ReadMemory(0x301), 6);
+	CHECK_EQUAL(image.memory[0x301], 0);
+	CHECK_EQUAL(second.ReadMemory(0x301), 0);
+	CHECK_EQUAL(first.ReadMemory(0x203), 0x42);
+
+	// A saved state holds the shared pages too
+	Chip8State saved;
+	first.SaveState(saved);
+	CHECK_EQUAL(saved.memory[0x203], 0x42);
+	CHECK_EQUAL(saved.memory[0x302], 6);
+	CHECK(first.Matches(saved));
+
+	// Restoring makes every page private, with the image's contents
+	first.RestoreDirty(image);
+	CHECK_EQUAL(first.GetSharedPages(), 0);
+	CHECK(first.Matches(image));
+	CHECK_EQUAL(first.Hash(), first.FullHash());
+}
+
+int main()
+{
+	RUN_TEST(TestClearScreen);
+	RUN_TEST(TestCallReturn);
+	RUN_TEST(TestStackTraps);
+	RUN_TEST(TestUnknownOpcode);
+	RUN_TEST(TestJumps);
+	RUN_TEST(TestSkips);
+	RUN_TEST(TestLoadAndAdd);
+	RUN_TEST(TestLogic);
+	RUN_TEST(TestAdd);
+	RUN_TEST(TestSubtract);
+	RUN_TEST(TestShifts);
+	RUN_TEST(TestRandom);
+	RUN_TEST(TestDraw);
+	RUN_TEST(TestDrawAtEdges);
+	RUN_TEST(TestKeys);
+	RUN_TEST(TestWaitForKey);
+	RUN_TEST(TestTimers);
+	RUN_TEST(TestIndex);
+	RUN_TEST(TestDecimal);
+	RUN_TEST(TestStoreLoad);
+	RUN_TEST(TestSelfModifyingCode);
+	RUN_TEST(TestSharedMemory);
+
+	if (CheckFailures() != 0)
+	{
+		std::fprintf(stderr, "%u checks failed\n", CheckFailures());
+		return 1;
+	}
+	return 0;
+}